@@ -0,0 +1,187 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <new>
+#include <optional>
+#include <type_traits>
+#include <vector>
+
+namespace naex {
+namespace grid {
+
+/**
+ * Fixed-size blocks carved from large chunks and recycled through free
+ * lists, one per size class. Blocks are returned to the pool, chunks are
+ * released with the pool only.
+ */
+class NodePool {
+public:
+  static constexpr size_t ALIGN = alignof(std::max_align_t);
+  static constexpr size_t MAX_SIZE = 8 * ALIGN;
+  static constexpr size_t CHUNK_BLOCKS = 4096;
+
+  NodePool() = default;
+  NodePool(const NodePool &) = delete;
+  NodePool &operator=(const NodePool &) = delete;
+  ~NodePool() {
+    for (void *chunk : chunks_) {
+      ::operator delete(chunk);
+    }
+  }
+
+  static bool pooled(size_t size) { return size <= MAX_SIZE; }
+
+  void *allocate(size_t size) {
+    Block *&head = free_[sizeClass(size)];
+    if (!head) {
+      refill(sizeClass(size));
+    }
+    Block *b = head;
+    head = b->next;
+    return b;
+  }
+
+  void deallocate(void *p, size_t size) {
+    Block *b = static_cast<Block *>(p);
+    Block *&head = free_[sizeClass(size)];
+    b->next = head;
+    head = b;
+  }
+
+protected:
+  struct Block {
+    Block *next;
+  };
+
+  static size_t sizeClass(size_t size) { return (size + ALIGN - 1) / ALIGN; }
+
+  void refill(size_t k) {
+    const size_t block_size = k * ALIGN;
+    char *chunk =
+        static_cast<char *>(::operator new(block_size * CHUNK_BLOCKS));
+    chunks_.push_back(chunk);
+    for (size_t i = CHUNK_BLOCKS; i-- > 0;) {
+      deallocate(chunk + i * block_size, block_size);
+    }
+  }
+
+  Block *free_[MAX_SIZE / ALIGN + 1]{};
+  std::vector<void *> chunks_;
+};
+
+/**
+ * Allocator of single nodes from a shared NodePool, e.g., for nodes of
+ * node-based containers. Arrays and large objects use the global heap.
+ */
+template <typename T> class PoolAllocator {
+public:
+  typedef T value_type;
+  // Moved containers take their pool along, copies get their own.
+  typedef std::true_type propagate_on_container_move_assignment;
+  typedef std::true_type propagate_on_container_swap;
+
+  PoolAllocator() : pool_(std::make_shared<NodePool>()) {}
+  template <typename U>
+  PoolAllocator(const PoolAllocator<U> &other) : pool_(other.pool_) {}
+  PoolAllocator select_on_container_copy_construction() const {
+    return PoolAllocator();
+  }
+
+  T *allocate(size_t n) {
+    if (n == 1 && NodePool::pooled(sizeof(T))) {
+      return static_cast<T *>(pool_->allocate(sizeof(T)));
+    }
+    return static_cast<T *>(::operator new(n * sizeof(T)));
+  }
+  void deallocate(T *p, size_t n) {
+    if (n == 1 && NodePool::pooled(sizeof(T))) {
+      pool_->deallocate(p, sizeof(T));
+      return;
+    }
+    ::operator delete(p);
+  }
+
+  template <typename U> bool operator==(const PoolAllocator<U> &other) const {
+    return pool_ == other.pool_;
+  }
+  template <typename U> bool operator!=(const PoolAllocator<U> &other) const {
+    return pool_ != other.pool_;
+  }
+
+protected:
+  template <typename U> friend class PoolAllocator;
+  std::shared_ptr<NodePool> pool_;
+};
+
+/**
+ * Per-plan scratch memory, a monotonic resource over a buffer which is
+ * released at once after each plan. Memory beyond the buffer comes from the
+ * heap, and the buffer is grown on release to cover it, so that plans of
+ * steady size do not allocate.
+ */
+class PlanArena {
+public:
+  explicit PlanArena(size_t size = 1 << 16) { reserve(size); }
+  PlanArena(const PlanArena &) = delete;
+  PlanArena &operator=(const PlanArena &) = delete;
+
+  std::pmr::memory_resource *resource() { return &*resource_; }
+  size_t capacity() const { return buffer_.size(); }
+
+  /** Release memory of the last plan, containers using it must be gone. */
+  void release() {
+    if (heap_.bytes > 0) {
+      reserve(2 * (buffer_.size() + heap_.bytes));
+    } else {
+      resource_->release();
+    }
+  }
+
+protected:
+  /** Heap resource counting bytes allocated since reset. */
+  struct Heap : std::pmr::memory_resource {
+    size_t bytes{0};
+
+    void *do_allocate(size_t size, size_t align) override {
+      bytes += size;
+      return std::pmr::new_delete_resource()->allocate(size, align);
+    }
+    void do_deallocate(void *p, size_t size, size_t align) override {
+      std::pmr::new_delete_resource()->deallocate(p, size, align);
+    }
+    bool do_is_equal(
+        const std::pmr::memory_resource &other) const noexcept override {
+      return this == &other;
+    }
+  };
+
+  void reserve(size_t size) {
+    resource_.reset();
+    heap_.bytes = 0;
+    buffer_.resize(size);
+    resource_.emplace(buffer_.data(), buffer_.size(), &heap_);
+  }
+
+  std::vector<std::byte> buffer_;
+  Heap heap_;
+  std::optional<std::pmr::monotonic_buffer_resource> resource_;
+};
+
+/**
+ * Number of heap allocations made through global operator new, counted only
+ * if the executable is built with GRID_PLANNER_COUNT_ALLOCATIONS, which
+ * replaces the global operators, see count_allocations.cpp.
+ */
+inline std::atomic<size_t> &allocationCounter() {
+  static std::atomic<size_t> count{0};
+  return count;
+}
+inline size_t allocationCount() {
+  return allocationCounter().load(std::memory_order_relaxed);
+}
+
+} // namespace grid
+} // namespace naex
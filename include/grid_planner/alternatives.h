@@ -0,0 +1,109 @@
+#pragma once
+
+#include "cost_to_go.h"
+#include "graph.h"
+#include "grid.h"
+#include "search.h"
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+namespace naex {
+namespace grid {
+
+struct AlternativePath {
+  std::vector<VertexId> path;
+  Cost cost;
+};
+
+/**
+ * Diverse alternative paths through via vertices.
+ *
+ * Both the search from the start and the cost-to-go field toward the goal
+ * are computed once and shared by all alternatives. A path via vertex v
+ * follows the search tree from the start to v and descends the field from v
+ * to the goal, with cost d_start(v) + d_goal(v). Via vertices are tried in
+ * order of this cost, and a path is accepted if its cost is within
+ * max_stretch times the shortest one, it does not visit any vertex twice,
+ * and at most max_overlap of its vertices lie on, or next to, already
+ * accepted paths. Vertices of tried paths are not tried as via vertices
+ * again, which bounds the work by the number of candidates.
+ *
+ * @return Up to k paths, the shortest one first.
+ */
+std::vector<AlternativePath>
+alternativePaths(const Graph &graph, const ShortestPaths &sp, VertexId start,
+                 const CostToGo &field, size_t k, float max_stretch,
+                 float max_overlap) {
+  std::vector<AlternativePath> paths;
+  const size_t n = sp.pathCosts().size();
+  std::vector<std::pair<Cost, VertexId>> candidates;
+  Cost best = Graph::INF;
+  for (VertexId v = 0; v < n; ++v) {
+    const Cost cost = sp.pathCost(v) + field.cost(v);
+    if (std::isfinite(cost)) {
+      candidates.emplace_back(cost, v);
+      best = std::min(best, cost);
+    }
+  }
+  if (!std::isfinite(best)) {
+    return paths;
+  }
+  const auto end = std::partition(
+      candidates.begin(), candidates.end(),
+      [best, max_stretch](const std::pair<Cost, VertexId> &c) {
+        return c.first <= max_stretch * best;
+      });
+  std::sort(candidates.begin(), end);
+
+  std::vector<uint8_t> accepted(n, 0);
+  std::vector<uint8_t> tried(n, 0);
+  // Index of the last candidate path visiting the vertex, plus one
+  std::vector<uint32_t> visited(n, 0);
+  uint32_t num_tried = 0;
+  std::vector<VertexId> path;
+  for (auto it = candidates.begin(); it != end && paths.size() < k; ++it) {
+    const VertexId via = it->second;
+    if (tried[via]) {
+      continue;
+    }
+    path.clear();
+    for (VertexId v = via; v != start; v = sp.predecessor(v)) {
+      path.push_back(v);
+    }
+    path.push_back(start);
+    std::reverse(path.begin(), path.end());
+    const auto to_goal = descendCostToGo(graph, field, via);
+    if (to_goal.empty()) {
+      tried[via] = 1;
+      continue;
+    }
+    path.insert(path.end(), to_goal.begin() + 1, to_goal.end());
+
+    ++num_tried;
+    size_t overlap = 0;
+    bool simple = true;
+    for (const auto &v : path) {
+      overlap += accepted[v];
+      tried[v] = 1;
+      simple = simple && visited[v] != num_tried;
+      visited[v] = num_tried;
+    }
+    if (!simple ||
+        (!paths.empty() && overlap > max_overlap * path.size())) {
+      continue;
+    }
+    for (const auto &v : path) {
+      accepted[v] = 1;
+      auto edges = graph.out_edges(v);
+      for (auto e = edges.first; e != edges.second; ++e) {
+        accepted[graph.target(*e)] = 1;
+      }
+    }
+    paths.push_back({path, it->first});
+  }
+  return paths;
+}
+
+} // namespace grid
+} // namespace naex
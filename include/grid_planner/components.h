@@ -0,0 +1,365 @@
+#pragma once
+
+#include "graph.h"
+#include "grid.h"
+#include "types.h"
+#include <condition_variable>
+#include <limits>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace naex {
+namespace grid {
+
+/**
+ * Connected components of traversable cells.
+ *
+ * Cells carry component labels, and labels are joined using union-find as
+ * cells become traversable, which costs proportionally to the changes.
+ * Union-find cannot split components, so cells becoming blocked leave the
+ * labels conservative, i.e., cells in different components are never
+ * connected, and trigger local relabeling in the background.
+ *
+ * The background thread keeps its own copy of cells and their
+ * traversability, updated with the new cells and traversability changes of
+ * each update. It floods traversable cells from the blocked cells and their
+ * neighbors, which covers the components that contained them. The pieces
+ * are installed with the next update: the largest piece of each component
+ * keeps its label, the others get new ones, and the changes made meanwhile
+ * are joined again. All methods must be called from the thread owning the
+ * grid.
+ *
+ * Decaying layers change without marking cells changed, so they are left out
+ * of the traversability test. Components are then a superset of the current
+ * ones, and cells in different components are still never connected.
+ */
+class Components {
+public:
+  Components() { worker_ = std::thread(&Components::relabel, this); }
+  ~Components() {
+    {
+      Lock lock(mutex_);
+      stop_ = true;
+    }
+    cv_.notify_one();
+    worker_.join();
+  }
+  Components(const Components &) = delete;
+  Components &operator=(const Components &) = delete;
+
+  bool traversable(CellId v) const {
+    return v < traversable_.size() && traversable_[v];
+  }
+  /** Root label of the cell component. */
+  CellId find(CellId v) {
+    CellId l = labels_[v];
+    while (parent_[l] != l) {
+      parent_[l] = parent_[parent_[l]];
+      l = parent_[l];
+    }
+    return l;
+  }
+  /** False only if the cells are not connected by traversable cells. */
+  bool connected(CellId u, CellId v) {
+    return traversable(u) && traversable(v) && find(u) == find(v);
+  }
+
+  void clear() {
+    Lock lock(mutex_);
+    labels_.clear();
+    parent_.clear();
+    traversable_.clear();
+    changes_.clear();
+    blocked_.clear();
+    pending_.clear();
+    num_sent_ = 0;
+    // Drop any relabeling in progress, the worker resets its cells.
+    ++generation_;
+    relabeling_ = false;
+    job_cells_.clear();
+    job_changes_.clear();
+    job_seeds_.clear();
+    has_result_ = false;
+  }
+
+  /** Update traversability of changed cells, installing relabeled ones. */
+  void update(const Graph &graph, const Grid &grid,
+              const std::vector<CellId> &changed) {
+    install(graph);
+    resize(grid.size());
+    for (const auto &v : changed) {
+      if (updateCell(graph, grid, v)) {
+        blocked_.push_back(v);
+      }
+      if (relabeling_) {
+        pending_.push_back(v);
+      }
+    }
+    send(graph, grid);
+  }
+
+protected:
+  void resize(size_t size) {
+    for (CellId v = CellId(labels_.size()); v < size; ++v) {
+      labels_.push_back(CellId(parent_.size()));
+      parent_.push_back(CellId(parent_.size()));
+    }
+    traversable_.resize(size, 0);
+  }
+
+  void unite(CellId u, CellId v) {
+    u = find(u);
+    v = find(v);
+    if (u != v) {
+      parent_[std::max(u, v)] = std::min(u, v);
+    }
+  }
+
+  void join(const Graph &graph, CellId v) {
+    auto edges = graph.out_edges(v);
+    for (auto it = edges.first; it != edges.second; ++it) {
+      const VertexId u = graph.target(*it);
+      if (u != v && traversable(u)) {
+        unite(u, v);
+      }
+    }
+  }
+
+  /** Cell is within max costs, in any of the decaying layers. */
+  static bool inBounds(const Graph &graph, const Grid &grid, CellId v) {
+    Costs costs = grid.currentCosts(v);
+    for (int l = 0; grid.decayingLayers() && l < 4; ++l) {
+      if (grid.decayingLayers() & (1 << l)) {
+        costs[l] = -std::numeric_limits<Cost>::infinity();
+      }
+    }
+    return graph.costsInBounds(costs);
+  }
+
+  /** Update cell traversability, return true if the cell got blocked. */
+  bool updateCell(const Graph &graph, const Grid &grid, CellId v) {
+    const bool t = inBounds(graph, grid, v);
+    if (t == bool(traversable_[v])) {
+      return false;
+    }
+    traversable_[v] = t;
+    changes_.emplace_back(v, uint8_t(t));
+    if (t) {
+      join(graph, v);
+    }
+    return !t;
+  }
+
+  /**
+   * Send new cells and traversability changes to the worker, with the cells
+   * blocked since the last relabeling unless one is in progress.
+   */
+  void send(const Graph &graph, const Grid &grid) {
+    const bool request = !relabeling_ && !blocked_.empty();
+    if (num_sent_ == grid.size() && changes_.empty() && !request) {
+      return;
+    }
+    {
+      Lock lock(mutex_);
+      for (CellId v = CellId(num_sent_); v < grid.size(); ++v) {
+        job_cells_.push_back(grid.cell(v));
+      }
+      job_changes_.insert(job_changes_.end(), changes_.begin(),
+                          changes_.end());
+      if (request) {
+        job_seeds_.swap(blocked_);
+        job_neighborhood_ = graph.neighborhood();
+      }
+    }
+    num_sent_ = grid.size();
+    changes_.clear();
+    if (request) {
+      blocked_.clear();
+      pending_.clear();
+      relabeling_ = true;
+    }
+    cv_.notify_one();
+  }
+
+  /** Install relabeled pieces and join changes made meanwhile again. */
+  void install(const Graph &graph) {
+    {
+      Lock lock(mutex_);
+      if (!has_result_) {
+        return;
+      }
+      has_result_ = false;
+      if (result_generation_ != generation_) {
+        return;
+      }
+      pieces_.swap(result_pieces_);
+      piece_cells_.swap(result_cells_);
+    }
+    // Largest piece of each component, by root label.
+    largest_.clear();
+    for (size_t p = 0; p + 1 < pieces_.size(); ++p) {
+      const CellId root = find(piece_cells_[pieces_[p]]);
+      const auto it = largest_.emplace(root, p).first;
+      const size_t q = it->second;
+      if (pieces_[p + 1] - pieces_[p] > pieces_[q + 1] - pieces_[q]) {
+        it->second = p;
+      }
+    }
+    for (size_t p = 0; p + 1 < pieces_.size(); ++p) {
+      if (largest_[find(piece_cells_[pieces_[p]])] == p) {
+        continue;
+      }
+      const CellId label = CellId(parent_.size());
+      parent_.push_back(label);
+      for (size_t i = pieces_[p]; i < pieces_[p + 1]; ++i) {
+        labels_[piece_cells_[i]] = label;
+      }
+    }
+    for (const auto &v : pending_) {
+      if (traversable_[v]) {
+        join(graph, v);
+      }
+    }
+    pending_.clear();
+    relabeling_ = false;
+  }
+
+  void relabel() {
+    // Cells and traversability as sent by the owner
+    std::vector<Cell> cells;
+    std::unordered_map<Cell, CellId, CellHasher> index;
+    std::vector<uint8_t> traversable;
+    uint32_t cells_generation = 0;
+    // Cell to the last flood which visited it
+    std::vector<uint32_t> visited;
+    uint32_t flood = 0;
+    std::vector<Cell> new_cells;
+    std::vector<std::pair<CellId, uint8_t>> changes;
+    std::vector<CellId> seeds;
+    std::vector<size_t> pieces;
+    std::vector<CellId> piece_cells;
+    while (true) {
+      uint8_t neighborhood;
+      uint32_t generation;
+      {
+        std::unique_lock<Mutex> lock(mutex_);
+        cv_.wait(lock, [this] {
+          return stop_ || !job_cells_.empty() || !job_changes_.empty() ||
+                 !job_seeds_.empty();
+        });
+        if (stop_) {
+          return;
+        }
+        new_cells.swap(job_cells_);
+        changes.swap(job_changes_);
+        seeds.swap(job_seeds_);
+        neighborhood = job_neighborhood_;
+        generation = generation_;
+      }
+
+      if (cells_generation != generation) {
+        cells.clear();
+        index.clear();
+        traversable.clear();
+        visited.clear();
+        cells_generation = generation;
+      }
+      for (const auto &c : new_cells) {
+        index[c] = CellId(cells.size());
+        cells.push_back(c);
+      }
+      traversable.resize(cells.size(), 0);
+      visited.resize(cells.size(), flood);
+      for (const auto &change : changes) {
+        traversable[change.first] = change.second;
+      }
+      new_cells.clear();
+      changes.clear();
+      if (seeds.empty()) {
+        continue;
+      }
+
+      // Flood traversable cells from the seeds and their neighbors, each
+      // flood filling one piece.
+      ++flood;
+      pieces.clear();
+      piece_cells.clear();
+      const auto neighbor = [neighborhood](const Cell &c, int j) {
+        return neighborhood == 8 ? neighbor8(c, j) : neighbor4(c, j);
+      };
+      const auto fill = [&](CellId v) {
+        if (!traversable[v] || visited[v] == flood) {
+          return;
+        }
+        visited[v] = flood;
+        pieces.push_back(piece_cells.size());
+        const size_t begin = piece_cells.size();
+        piece_cells.push_back(v);
+        for (size_t i = begin; i < piece_cells.size(); ++i) {
+          const Cell cell = cells[piece_cells[i]];
+          for (int j = 0; j < neighborhood; ++j) {
+            const auto it = index.find(neighbor(cell, j));
+            if (it != index.end() && traversable[it->second] &&
+                visited[it->second] != flood) {
+              visited[it->second] = flood;
+              piece_cells.push_back(it->second);
+            }
+          }
+        }
+      };
+      for (const auto &v : seeds) {
+        fill(v);
+        for (int j = 0; j < neighborhood; ++j) {
+          const auto it = index.find(neighbor(cells[v], j));
+          if (it != index.end()) {
+            fill(it->second);
+          }
+        }
+      }
+      pieces.push_back(piece_cells.size());
+      seeds.clear();
+
+      Lock lock(mutex_);
+      result_pieces_.swap(pieces);
+      result_cells_.swap(piece_cells);
+      result_generation_ = generation;
+      has_result_ = true;
+    }
+  }
+
+  // CellId to label, label to union-find parent
+  std::vector<CellId> labels_;
+  std::vector<CellId> parent_;
+  // CellId to traversability
+  std::vector<uint8_t> traversable_;
+  // Traversability changes and cells not sent to the worker yet
+  std::vector<std::pair<CellId, uint8_t>> changes_;
+  size_t num_sent_{0};
+  // Cells blocked since the last relabeling request
+  std::vector<CellId> blocked_;
+  // Cells changed while relabeling
+  std::vector<CellId> pending_;
+  bool relabeling_{false};
+  // Installed pieces, as offsets into the piece cells, and largest pieces
+  std::vector<size_t> pieces_;
+  std::vector<CellId> piece_cells_;
+  std::unordered_map<CellId, size_t> largest_;
+
+  Mutex mutex_;
+  std::condition_variable cv_;
+  std::vector<Cell> job_cells_;
+  std::vector<std::pair<CellId, uint8_t>> job_changes_;
+  std::vector<CellId> job_seeds_;
+  uint8_t job_neighborhood_{8};
+  std::vector<size_t> result_pieces_;
+  std::vector<CellId> result_cells_;
+  uint32_t result_generation_{0};
+  bool has_result_{false};
+  uint32_t generation_{0};
+  bool stop_{false};
+  std::thread worker_;
+};
+
+} // namespace grid
+} // namespace naex
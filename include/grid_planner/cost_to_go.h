@@ -0,0 +1,351 @@
+#pragma once
+
+#include "graph.h"
+#include "grid.h"
+#include "hash.h"
+#include "search.h"
+#include "snapshot.h"
+#include "tiles.h"
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace naex {
+namespace grid {
+
+/**
+ * Cost-to-go field toward a goal cell.
+ *
+ * Edge costs are symmetric, so the field is computed by a full search rooted
+ * at the goal. The field remains valid until a tile it reaches, or a tile
+ * next to these, is updated.
+ */
+struct CostToGo {
+  Cell goal;
+  // Grid epoch the field was computed at.
+  uint32_t epoch;
+  std::vector<Cost> costs;
+  // Tiles with reached cells and their neighbors.
+  std::unordered_set<Tile, TileHasher> tiles;
+
+  Cost cost(VertexId v) const {
+    return v < costs.size() ? costs[v] : std::numeric_limits<Cost>::quiet_NaN();
+  }
+  Cost cellCost(const Grid &grid, const Cell &c) const {
+    const auto v = grid.findCell(c);
+    return v ? cost(*v) : std::numeric_limits<Cost>::quiet_NaN();
+  }
+
+  /**
+   * Bilinear interpolation of the field between cell centers, with its
+   * gradient. If any of the four cells is not reachable, the cost of the
+   * cell containing the point is returned with NaN gradient.
+   */
+  Cost interpolate(const Grid &grid, const Point2f &p, Cost &dx,
+                   Cost &dy) const {
+    const float u = p.x / grid.cellSize() - 0.5f;
+    const float v = p.y / grid.cellSize() - 0.5f;
+    const Cell c00(std::floor(u), std::floor(v));
+    const float fx = u - c00.x;
+    const float fy = v - c00.y;
+    const Cost c[4] = {cellCost(grid, c00),
+                       cellCost(grid, Cell(c00.x + 1, c00.y)),
+                       cellCost(grid, Cell(c00.x, c00.y + 1)),
+                       cellCost(grid, Cell(c00.x + 1, c00.y + 1))};
+    if (!(std::isfinite(c[0]) && std::isfinite(c[1]) && std::isfinite(c[2]) &&
+          std::isfinite(c[3]))) {
+      dx = dy = std::numeric_limits<Cost>::quiet_NaN();
+      return c[(fx >= 0.5f) + 2 * (fy >= 0.5f)];
+    }
+    dx = ((1 - fy) * (c[1] - c[0]) + fy * (c[3] - c[2])) / grid.cellSize();
+    dy = ((1 - fx) * (c[2] - c[0]) + fx * (c[3] - c[1])) / grid.cellSize();
+    return (1 - fy) * ((1 - fx) * c[0] + fx * c[1]) +
+           fy * ((1 - fx) * c[2] + fx * c[3]);
+  }
+
+  void updateTiles(const Grid &grid) {
+    tiles.clear();
+    for (VertexId v = 0; v < costs.size(); ++v) {
+      if (!std::isfinite(costs[v])) {
+        continue;
+      }
+      const Tile t = cellToTile(grid.cell(v));
+      if (tiles.insert(t).second) {
+        for (int i = 0; i < 8; ++i) {
+          tiles.insert(neighbor8(t, i));
+        }
+      }
+    }
+  }
+
+  bool valid(const Grid &grid) const {
+    for (const auto &t : tiles) {
+      if (grid.tileEpoch(t) > epoch) {
+        return false;
+      }
+    }
+    return true;
+  }
+};
+
+/**
+ * Descend the cost-to-go field from start to goal.
+ * @return Path vertices, empty if the goal is not reachable.
+ */
+std::vector<VertexId> descendCostToGo(const Graph &graph, const CostToGo &field,
+                                      VertexId start) {
+  std::vector<VertexId> path;
+  VertexId u = start;
+  if (!std::isfinite(field.cost(u))) {
+    return path;
+  }
+  path.push_back(u);
+  while (field.cost(u) > 0) {
+    VertexId best = u;
+    Cost best_cost = Graph::INF;
+    auto edges = graph.out_edges(u);
+    for (auto it = edges.first; it != edges.second; ++it) {
+      const VertexId v = graph.target(*it);
+      const Cost c = graph.cost(*it) + field.cost(v);
+      if (v != u && c < best_cost) {
+        best = v;
+        best_cost = c;
+      }
+    }
+    // Costs must strictly decrease toward the goal.
+    if (best == u || !(field.cost(best) < field.cost(u))) {
+      path.clear();
+      break;
+    }
+    path.push_back(best);
+    u = best;
+  }
+  return path;
+}
+
+/** Least recently used cost-to-go fields keyed by goal cell. */
+class CostToGoCache {
+public:
+  typedef std::shared_ptr<const CostToGo> FieldPtr;
+
+  CostToGoCache(size_t capacity = 4) : capacity_(capacity) {}
+
+  /** Return a valid field for the goal if there is one. */
+  FieldPtr find(const Grid &grid, const Cell &goal) {
+    for (auto it = fields_.begin(); it != fields_.end(); ++it) {
+      if (!((*it)->goal == goal)) {
+        continue;
+      }
+      if ((*it)->valid(grid)) {
+        fields_.splice(fields_.begin(), fields_, it);
+        return fields_.front();
+      }
+      fields_.erase(it);
+      break;
+    }
+    return nullptr;
+  }
+
+  /** Return the field for the goal, computing it if missing or outdated. */
+  FieldPtr get(const Grid &grid, const Cell &goal, uint8_t neighborhood,
+               const Costs &max_costs) {
+    auto field = find(grid, goal);
+    if (field || !grid.hasCell(goal)) {
+      return field;
+    }
+    auto new_field = std::make_shared<CostToGo>();
+    new_field->goal = goal;
+    new_field->epoch = grid.epoch();
+    ShortestPaths sp(grid, grid.cellId(goal), std::nullopt, neighborhood,
+                     max_costs);
+    new_field->costs = sp.pathCosts();
+    new_field->updateTiles(grid);
+    insert(new_field);
+    return new_field;
+  }
+
+  void insert(FieldPtr field) {
+    for (auto it = fields_.begin(); it != fields_.end(); ++it) {
+      if ((*it)->goal == field->goal) {
+        fields_.erase(it);
+        break;
+      }
+    }
+    fields_.push_front(field);
+    if (fields_.size() > capacity_) {
+      fields_.pop_back();
+    }
+  }
+
+  /** Count a planning request toward the goal, return the count so far. */
+  size_t countRequest(const Cell &goal) {
+    if (requests_.size() > 1024) {
+      requests_.clear();
+    }
+    return ++requests_[goal];
+  }
+
+  const std::list<FieldPtr> &fields() const { return fields_; }
+  void clear() { fields_.clear(); }
+
+protected:
+  size_t capacity_;
+  std::list<FieldPtr> fields_;
+  std::unordered_map<Cell, size_t, CellHasher> requests_;
+};
+
+/**
+ * Hash of the static layers of cells reached by the field, independent of
+ * cell ids and their order.
+ */
+uint64_t staticLayersHash(const Grid &grid, const CostToGo &field,
+                          uint8_t layers) {
+  uint64_t hash = 0;
+  for (VertexId v = 0; v < field.costs.size() && v < grid.size(); ++v) {
+    if (!std::isfinite(field.costs[v])) {
+      continue;
+    }
+    size_t seed = 0;
+    hash_combine(seed, grid.cell(v).x);
+    hash_combine(seed, grid.cell(v).y);
+    for (int l = 0; l < 4; ++l) {
+      if (layers & (1 << l)) {
+        hash_combine(seed, grid.currentCosts(v)[l]);
+      }
+    }
+    hash += seed;
+  }
+  return hash;
+}
+
+/**
+ * Cost-to-go cache file, a header followed by fields, each with goal cell,
+ * static layers hash, number of tiles, and tiles of cost-to-go in layer 0.
+ */
+struct CostToGoFileHeader {
+  char magic[4]{'G', 'P', 'C', 'G'};
+  uint32_t version{1};
+  float cell_size{0.f};
+  // Grid epoch the fields are valid at.
+  uint32_t epoch{0};
+  uint8_t neighborhood{0};
+  uint8_t reserved[3]{0, 0, 0};
+  Cost max_costs[4];
+  uint32_t num_fields{0};
+
+  bool valid() const {
+    return magic[0] == 'G' && magic[1] == 'P' && magic[2] == 'C' &&
+           magic[3] == 'G' && version == 1;
+  }
+  bool sameCosts(const Costs &costs) const {
+    for (int i = 0; i < 4; ++i) {
+      if (!(max_costs[i] == costs[i]) &&
+          !(std::isnan(max_costs[i]) && std::isnan(costs[i]))) {
+        return false;
+      }
+    }
+    return true;
+  }
+};
+static_assert(sizeof(CostToGoFileHeader) == 40);
+
+/** Encode valid fields of the cache, stamped with the grid epoch. */
+void encodeCostToGoCache(const Grid &grid, const CostToGoCache &cache,
+                         uint8_t neighborhood, const Costs &max_costs,
+                         uint8_t static_layers, std::vector<uint8_t> &buf) {
+  CostToGoFileHeader header;
+  header.cell_size = grid.cellSize();
+  header.epoch = grid.epoch();
+  header.neighborhood = neighborhood;
+  std::copy(max_costs.data, max_costs.data + 4, header.max_costs);
+  buf.clear();
+  buf.resize(sizeof(header));
+  std::vector<CellId> ids;
+  for (const auto &field : cache.fields()) {
+    if (!field->valid(grid)) {
+      continue;
+    }
+    ids.clear();
+    for (VertexId v = 0; v < field->costs.size(); ++v) {
+      if (std::isfinite(field->costs[v])) {
+        ids.push_back(v);
+      }
+    }
+    appendBytes(field->goal.x, buf);
+    appendBytes(field->goal.y, buf);
+    appendBytes(staticLayersHash(grid, *field, static_layers), buf);
+    const size_t num_tiles_offset = buf.size();
+    appendBytes(uint32_t(0), buf);
+    const uint32_t num_tiles = uint32_t(encodeCellTiles(
+        grid, ids, 1, [&field](CellId v) { return Costs(field->costs[v]); },
+        buf));
+    std::memcpy(&buf[num_tiles_offset], &num_tiles, sizeof(num_tiles));
+    ++header.num_fields;
+  }
+  std::memcpy(buf.data(), &header, sizeof(header));
+}
+
+/**
+ * Load cached fields whose static layers hash matches the grid. Fields with
+ * cells missing in the grid are skipped, the grid is not modified.
+ * Fields are valid at the epoch stored, later updates invalidate them.
+ * @return Number of fields loaded, or -1 if the file is invalid.
+ */
+long loadCostToGoCache(const std::string &path, const Grid &grid,
+                       uint8_t neighborhood, const Costs &max_costs,
+                       uint8_t static_layers, CostToGoCache &cache) {
+  std::vector<uint8_t> buf;
+  if (!readFile(path, buf)) {
+    return -1;
+  }
+  CostToGoFileHeader header;
+  size_t offset = 0;
+  if (!readBytes(buf.data(), buf.size(), offset, header) || !header.valid() ||
+      header.cell_size != grid.cellSize() ||
+      header.neighborhood != neighborhood || !header.sameCosts(max_costs)) {
+    return -1;
+  }
+  long n = 0;
+  Tile tile;
+  uint8_t layers;
+  std::vector<TileCell> cells;
+  for (uint32_t i = 0; i < header.num_fields; ++i) {
+    auto field = std::make_shared<CostToGo>();
+    uint64_t hash;
+    uint32_t num_tiles;
+    if (!readBytes(buf.data(), buf.size(), offset, field->goal.x) ||
+        !readBytes(buf.data(), buf.size(), offset, field->goal.y) ||
+        !readBytes(buf.data(), buf.size(), offset, hash) ||
+        !readBytes(buf.data(), buf.size(), offset, num_tiles)) {
+      return -1;
+    }
+    field->epoch = header.epoch;
+    field->costs.resize(grid.size(), std::numeric_limits<Cost>::infinity());
+    bool missing = false;
+    for (uint32_t j = 0; j < num_tiles; ++j) {
+      if (!decodeTile(buf.data(), buf.size(), offset, tile, layers, cells)) {
+        return -1;
+      }
+      for (const auto &c : cells) {
+        const auto v = grid.findCell(tileCell(tile, c.index));
+        if (!v) {
+          missing = true;
+          continue;
+        }
+        field->costs[*v] = c.costs[0];
+      }
+    }
+    if (missing || staticLayersHash(grid, *field, static_layers) != hash) {
+      continue;
+    }
+    field->updateTiles(grid);
+    cache.insert(field);
+    ++n;
+  }
+  return n;
+}
+
+} // namespace grid
+} // namespace naex
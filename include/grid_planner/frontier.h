@@ -0,0 +1,221 @@
+#pragma once
+
+#include "graph.h"
+#include "grid.h"
+#include "types.h"
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+namespace naex {
+namespace grid {
+
+/**
+ * Frontier of the known map, traversable cells with an 8-neighbor which is
+ * missing or not observed yet.
+ *
+ * Only changed cells and their neighbors may change their frontier status,
+ * so updates cost proportionally to the changes. Clusters of 8-connected
+ * frontier cells are maintained incrementally: clusters losing a cell or
+ * touching a new one are dissolved and flood-filled again, so the cost is
+ * proportional to the sizes of the clusters affected, not to the frontier.
+ */
+class Frontier {
+public:
+  static constexpr uint32_t NONE = std::numeric_limits<uint32_t>::max();
+
+  size_t size() const { return cells_.size(); }
+  const std::vector<CellId> &cells() const { return cells_; }
+  bool contains(CellId v) const {
+    return v < index_.size() && index_[v] != NONE;
+  }
+  /** Clusters of frontier cells, empty ones are unused slots. */
+  const std::vector<std::vector<CellId>> &clusters() const {
+    return clusters_;
+  }
+  size_t numClusters() const { return clusters_.size() - free_.size(); }
+  /** Length of the cluster of a frontier cell in meters, zero elsewhere. */
+  float utility(CellId v) const {
+    return v < utility_.size() ? utility_[v] : 0.f;
+  }
+
+  void clear() {
+    cells_.clear();
+    index_.clear();
+    cluster_.clear();
+    utility_.clear();
+    clusters_.clear();
+    free_.clear();
+    added_.clear();
+    affected_.clear();
+  }
+
+  /** Update frontier status of changed cells and their neighbors. */
+  void update(const Graph &graph, const Grid &grid,
+              const std::vector<CellId> &changed) {
+    index_.resize(grid.size(), NONE);
+    cluster_.resize(grid.size(), NONE);
+    utility_.resize(grid.size(), 0.f);
+    for (const auto &v : changed) {
+      updateCell(graph, grid, v);
+      for (int i = 0; i < 8; ++i) {
+        if (const auto u = grid.findCell(neighbor8(grid.cell(v), i))) {
+          updateCell(graph, grid, *u);
+        }
+      }
+    }
+    if (!added_.empty() || !affected_.empty()) {
+      updateClusters(grid);
+    }
+  }
+
+  /**
+   * Reachable frontier cell with the lowest path cost minus weighted
+   * utility, within clusters of at least min_size cells.
+   * @return The cell, or INVALID_VERTEX if there is none.
+   */
+  VertexId best(const std::vector<Cost> &path_costs, float utility_weight,
+                size_t min_size) const {
+    VertexId best = INVALID_VERTEX;
+    Cost best_cost = std::numeric_limits<Cost>::infinity();
+    for (const auto &cluster : clusters_) {
+      if (cluster.size() < min_size) {
+        continue;
+      }
+      for (const auto &v : cluster) {
+        if (v >= path_costs.size() || !std::isfinite(path_costs[v])) {
+          continue;
+        }
+        const Cost cost = path_costs[v] - utility_weight * utility_[v];
+        if (cost < best_cost) {
+          best = v;
+          best_cost = cost;
+        }
+      }
+    }
+    return best;
+  }
+
+protected:
+  bool isFrontier(const Graph &graph, const Grid &grid, CellId v) const {
+    if (!graph.costsInBounds(grid.currentCosts(v))) {
+      return false;
+    }
+    for (int i = 0; i < 8; ++i) {
+      const auto u = grid.findCell(neighbor8(grid.cell(v), i));
+      if (!u || !grid.observed(*u)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void updateCell(const Graph &graph, const Grid &grid, CellId v) {
+    const bool frontier = isFrontier(graph, grid, v);
+    if (frontier == contains(v)) {
+      return;
+    }
+    if (frontier) {
+      index_[v] = uint32_t(cells_.size());
+      cells_.push_back(v);
+      added_.push_back(v);
+      return;
+    }
+    // Swap with the last cell to remove in constant time.
+    const CellId last = cells_.back();
+    cells_[index_[v]] = last;
+    index_[last] = index_[v];
+    cells_.pop_back();
+    index_[v] = NONE;
+    // The cluster may split.
+    if (cluster_[v] != NONE) {
+      affected_.push_back(cluster_[v]);
+      cluster_[v] = NONE;
+      utility_[v] = 0.f;
+    }
+  }
+
+  /** Dissolve affected clusters and flood-fill them with new cells. */
+  void updateClusters(const Grid &grid) {
+    // New cells may join or merge clusters next to them.
+    for (const auto &v : added_) {
+      if (!contains(v)) {
+        continue;
+      }
+      seeds_.push_back(v);
+      for (int i = 0; i < 8; ++i) {
+        const auto u = grid.findCell(neighbor8(grid.cell(v), i));
+        if (u && contains(*u) && cluster_[*u] != NONE) {
+          affected_.push_back(cluster_[*u]);
+        }
+      }
+    }
+    std::sort(affected_.begin(), affected_.end());
+    affected_.erase(std::unique(affected_.begin(), affected_.end()),
+                    affected_.end());
+    for (const auto &k : affected_) {
+      for (const auto &v : clusters_[k]) {
+        if (cluster_[v] != k) {
+          continue;
+        }
+        cluster_[v] = NONE;
+        utility_[v] = 0.f;
+        seeds_.push_back(v);
+      }
+      clusters_[k].clear();
+      free_.push_back(k);
+    }
+
+    for (const auto &seed : seeds_) {
+      if (!contains(seed) || cluster_[seed] != NONE) {
+        continue;
+      }
+      uint32_t k;
+      if (free_.empty()) {
+        k = uint32_t(clusters_.size());
+        clusters_.emplace_back();
+      } else {
+        k = free_.back();
+        free_.pop_back();
+      }
+      std::vector<CellId> &cluster = clusters_[k];
+      cluster_[seed] = k;
+      cluster.push_back(seed);
+      for (size_t j = 0; j < cluster.size(); ++j) {
+        for (int i = 0; i < 8; ++i) {
+          const auto u = grid.findCell(neighbor8(grid.cell(cluster[j]), i));
+          if (u && contains(*u) && cluster_[*u] == NONE) {
+            cluster_[*u] = k;
+            cluster.push_back(*u);
+          }
+        }
+      }
+      const float length = cluster.size() * grid.cellSize();
+      for (const auto &v : cluster) {
+        utility_[v] = length;
+      }
+    }
+    added_.clear();
+    affected_.clear();
+    seeds_.clear();
+  }
+
+  // Frontier cells in no particular order
+  std::vector<CellId> cells_;
+  // CellId to index in cells_, or NONE
+  std::vector<uint32_t> index_;
+  // CellId to index of its cluster, or NONE
+  std::vector<uint32_t> cluster_;
+  // CellId to utility of its cluster
+  std::vector<float> utility_;
+  std::vector<std::vector<CellId>> clusters_;
+  // Unused cluster slots
+  std::vector<uint32_t> free_;
+  // Cells added and clusters losing cells since clusters were updated
+  std::vector<CellId> added_;
+  std::vector<uint32_t> affected_;
+  std::vector<CellId> seeds_;
+};
+
+} // namespace grid
+} // namespace naex
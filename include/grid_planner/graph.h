@@ -97,7 +97,8 @@ public:
 
   Graph(const Grid &grid, const uint8_t neighborhood = 8,
         const Costs &max_costs = Costs())
-      : grid_(grid), neighborhood_(neighborhood), max_costs_(max_costs) {
+      : grid_(grid), neighborhood_(neighborhood), max_costs_(max_costs),
+        totals_(sameCosts(grid.maxCosts(), max_costs)) {
     assert(neighborhood == 4 || neighborhood == 8);
   }
   Graph() : Graph(Grid()) {}
@@ -110,6 +111,7 @@ public:
     return {EdgeIter(neighborhood_ * u), EdgeIter(neighborhood_ * (u + 1))};
   }
   inline EdgeId out_degree(const VertexId &u) const { return neighborhood_; }
+  inline uint8_t neighborhood() const { return neighborhood_; }
   inline VertexId source(const EdgeId &e) const { return e / neighborhood_; }
   inline VertexId target_index(const EdgeId &e) const {
     return e % neighborhood_;
@@ -126,37 +128,47 @@ public:
       cell = neighbor4(cell, i);
     }
 
-    if (grid_.hasCell(cell)) {
-      return grid_.cellId(cell);
-    }
-    return s;
+    const auto v = grid_.findCell(cell);
+    return v ? *v : s;
   }
 
   bool costsInBounds(const Costs &costs) const {
-    for (size_t i = 0; i < 4; ++i) {
-      // Stop on first invalid max cost.
-      if (!std::isfinite(max_costs_[i])) {
-        break;
-      }
-      if (!(costs[i] <= max_costs_[i])) {
-        return false;
+    return grid::costsInBounds(costs, max_costs_);
+  }
+
+  inline Cost cost(const EdgeId &e) const {
+    if (totals_) {
+      // Totals kept by the grid, infinite outside max costs.
+      const Cost t0 = grid_.traversalCost(source(e));
+      const Cost t1 = grid_.traversalCost(target(e));
+      if (std::isinf(t0) || std::isinf(t1)) {
+        return INF;
       }
+      return costFromTotals(e, t0 + t1);
+    }
+    if (grid_.rawCosts()) {
+      return cost(e, grid_.costs(source(e)), grid_.costs(target(e)));
     }
-    return true;
+    return cost(e, grid_.currentCosts(source(e)),
+                grid_.currentCosts(target(e)));
   }
 
-  inline Cost cost(const EdgeId &e) const {
+  inline Cost cost(const EdgeId &e, const Costs &c0, const Costs &c1) const {
     // Ensure all costs are in bounds if provided.
-    const auto &c0 = grid_.costs(source(e));
     if (!costsInBounds(c0)) {
       return INF;
     }
-    const auto &c1 = grid_.costs(target(e));
     if (!costsInBounds(c1)) {
       return INF;
     }
 
-    auto cost = 1 + (c0.total() + c1.total()) / 2;
+    return costFromTotals(e, c0.total() + c1.total());
+  }
+
+protected:
+  /** Edge cost from the sum of total costs of its vertices. */
+  inline Cost costFromTotals(const EdgeId &e, Cost totals) const {
+    auto cost = 1 + totals / 2;
 
     cost *= grid_.cellSize();
     if (neighborhood_ == 8) {
@@ -165,10 +177,11 @@ public:
     return cost;
   }
 
-protected:
   const Grid &grid_;
   const uint8_t neighborhood_;
   const Costs max_costs_;
+  // Use totals precomputed by the grid.
+  const bool totals_;
 };
 
 class EdgeCosts {
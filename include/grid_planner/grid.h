@@ -1,9 +1,16 @@
 #pragma once
 
+#include "allocators.h"
 #include "hash.h"
+#include <algorithm>
+#include <array>
 #include <cassert>
 #include <cmath>
 #include <cstdint>
+#include <functional>
+#include <limits>
+#include <optional>
+#include <string>
 #include <unordered_map>
 #include <vector>
 
@@ -59,6 +66,26 @@ typedef Point2Hasher<float> Point2fHasher;
 typedef Point2Hasher<int16_t> Point2sHasher;
 typedef Point2sHasher CellHasher;
 
+/** Tiles group TILE_SIZE x TILE_SIZE cells. */
+typedef Point2s Tile;
+typedef Point2sHasher TileHasher;
+
+const int TILE_BITS = 4;
+const int TILE_SIZE = 1 << TILE_BITS;
+const int TILE_CELLS = TILE_SIZE * TILE_SIZE;
+
+inline Tile cellToTile(const Cell &c) {
+  return Tile(c.x >> TILE_BITS, c.y >> TILE_BITS);
+}
+inline uint8_t cellIndexInTile(const Cell &c) {
+  return uint8_t(((c.y & (TILE_SIZE - 1)) << TILE_BITS) |
+                 (c.x & (TILE_SIZE - 1)));
+}
+inline Cell tileCell(const Tile &t, uint8_t i) {
+  return Cell(t.x * TILE_SIZE + (i & (TILE_SIZE - 1)),
+              t.y * TILE_SIZE + (i >> TILE_BITS));
+}
+
 struct Costs {
   Costs(Cost c0 = std::numeric_limits<Cost>::quiet_NaN(),
         Cost c1 = std::numeric_limits<Cost>::quiet_NaN(),
@@ -92,11 +119,84 @@ struct Costs {
   }
 };
 
-// TODO: Move max costs and total to grid.
+/** How new observations of a layer are fused with the stored cost. */
+enum class Fusion : uint8_t { EMA, MAX, MIN, LOG_ODDS, OVERWRITE };
+
+inline bool parseFusion(const std::string &name, Fusion &fusion) {
+  static const std::pair<const char *, Fusion> names[] = {
+      {"ema", Fusion::EMA},
+      {"max", Fusion::MAX},
+      {"min", Fusion::MIN},
+      {"log_odds", Fusion::LOG_ODDS},
+      {"overwrite", Fusion::OVERWRITE}};
+  for (const auto &n : names) {
+    if (name == n.first) {
+      fusion = n.second;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Log-odds are clamped so that cells can still change their mind.
+const Cost MAX_LOG_ODDS = 10.f;
+
+/**
+ * Fused cost from a finite stored cost and a finite observation with given
+ * weight.
+ */
+template <Fusion F> inline Cost fuse(Cost stored, Cost cost, float weight);
+template <>
+inline Cost fuse<Fusion::EMA>(Cost stored, Cost cost, float weight) {
+  return (1.f - weight) * stored + weight * cost;
+}
+template <>
+inline Cost fuse<Fusion::MAX>(Cost stored, Cost cost, float) {
+  return std::max(stored, cost);
+}
+template <>
+inline Cost fuse<Fusion::MIN>(Cost stored, Cost cost, float) {
+  return std::min(stored, cost);
+}
+template <>
+inline Cost fuse<Fusion::LOG_ODDS>(Cost stored, Cost cost, float) {
+  return std::min(std::max(stored + cost, -MAX_LOG_ODDS), MAX_LOG_ODDS);
+}
+template <>
+inline Cost fuse<Fusion::OVERWRITE>(Cost, Cost cost, float) {
+  return cost;
+}
+
+/** Costs are within max costs, up to the first max cost which is not finite. */
+inline bool costsInBounds(const Costs &costs, const Costs &max_costs) {
+  for (size_t i = 0; i < 4; ++i) {
+    if (!std::isfinite(max_costs[i])) {
+      break;
+    }
+    if (!(costs[i] <= max_costs[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/** Both costs are equal, or both NaN, in all layers. */
+inline bool sameCosts(const Costs &a, const Costs &b) {
+  for (size_t i = 0; i < 4; ++i) {
+    if (!(a[i] == b[i] || (std::isnan(a[i]) && std::isnan(b[i])))) {
+      return false;
+    }
+  }
+  return true;
+}
+
 // TODO: Add costs weights for total.
 // TODO: Add required flags for total.
 class Grid {
 public:
+  // Loads a tile into the grid on first access, returns true if loaded.
+  typedef std::function<bool(const Tile &)> TileLoader;
+
   Grid(float cell_size = 1.f, float forget_factor = 1.f,
        const Costs &default_costs = Costs())
       : cell_size_(cell_size), forget_factor_(forget_factor),
@@ -105,10 +205,25 @@ public:
   bool hasCell(const Cell &c) const {
     return cell_to_id_.find(c) != cell_to_id_.end();
   }
+  /** Create the cell with default costs, touching its tile. */
   void createCell(const Cell &c) {
+    touchTile(cellToTile(c));
     cell_to_id_[c] = size();
     id_to_cell_.push_back(c);
     id_to_costs_.push_back(default_costs_);
+    id_to_total_.push_back(0);
+    updateTotal(CellId(size() - 1));
+    id_to_stamp_.push_back(time_);
+    id_to_counts_.push_back({0, 0, 0, 0});
+    for (int l = 0; l < 4; ++l) {
+      if (layer_shifts_[l]) {
+        const uint32_t i = coarseIndex(c, l);
+        id_to_coarse_[l].push_back(i);
+        coarse_cells_[l][i].cells.push_back(CellId(size() - 1));
+      }
+    }
+    changed_.push_back(0);
+    markChanged(CellId(size() - 1));
   }
 
   const Cell &cell(const CellId &id) const {
@@ -123,7 +238,10 @@ public:
 
   CellId &cellId(const Cell &c) {
     if (!hasCell(c)) {
-      createCell(c);
+      // The cell may come with its tile, create it otherwise.
+      if (!(tile_loader_ && tile_loader_(cellToTile(c)) && hasCell(c))) {
+        createCell(c);
+      }
     }
     return cell_to_id_[c];
   }
@@ -131,6 +249,17 @@ public:
     assert(hasCell(c));
     return cell_to_id_.find(c)->second;
   }
+  /** Id of an existing cell, never creating the cell nor loading its tile. */
+  std::optional<CellId> findCell(const Cell &c) const {
+    const auto it = cell_to_id_.find(c);
+    if (it == cell_to_id_.end()) {
+      return std::nullopt;
+    }
+    return it->second;
+  }
+  std::optional<CellId> findPoint(const Point2f &p) const {
+    return findCell(pointToCell(p));
+  }
 
   Cell pointToCell(const Point2f &p) const {
     return Cell(std::floor(p.x / cell_size_), std::floor(p.y / cell_size_));
@@ -150,41 +279,607 @@ public:
   Costs &cellCosts(const Cell &c) { return costs(cellId(c)); }
   Costs &pointCosts(const Point2f &p) { return cellCosts(pointToCell(p)); }
 
-  Costs &updateCellCost(Cell c, int level, Cost cost) {
-    Costs &costs = cellCosts(c);
-    if (std::isfinite(costs.data[level])) {
-      Cost w0 = (1. - forget_factor_);
-      Cost w1 = forget_factor_;
-      costs.data[level] = w0 * costs.data[level] + w1 * cost;
-    } else {
-      costs.data[level] = cost;
+  Fusion fusion(int level) const { return fusions_[level]; }
+  void setFusion(int level, Fusion fusion) { fusions_[level] = fusion; }
+
+  /** Fuse the observation into the cell layer, return the fused cost. */
+  Cost updateCellCost(Cell c, int level, Cost cost) {
+    switch (fusions_[level]) {
+    case Fusion::MAX:
+      return updateCellCost<Fusion::MAX>(c, level, cost);
+    case Fusion::MIN:
+      return updateCellCost<Fusion::MIN>(c, level, cost);
+    case Fusion::LOG_ODDS:
+      return updateCellCost<Fusion::LOG_ODDS>(c, level, cost);
+    case Fusion::OVERWRITE:
+      return updateCellCost<Fusion::OVERWRITE>(c, level, cost);
+    default:
+      return updateCellCost<Fusion::EMA>(c, level, cost);
+    }
+  }
+  template <Fusion F> Cost updateCellCost(Cell c, int level, Cost cost) {
+    if (layer_shifts_[level]) {
+      const uint32_t i = coarseIndex(c, level);
+      Cost &stored = coarse_costs_[level][i];
+      stored = std::isfinite(stored) ? fuse<F>(stored, cost, forget_factor_)
+                                     : cost;
+      coarseChanged(level, i);
+      // Existing cells count coarse observations falling into them.
+      if (const auto id = findCell(c)) {
+        uint8_t &count = id_to_counts_[*id][level];
+        if (count < MAX_COUNT) {
+          ++count;
+        }
+      }
+      return stored;
+    }
+    touchTile(cellToTile(c));
+    const CellId id = cellId(c);
+    markChanged(id);
+    Costs &cell_costs = stampCosts(id);
+    Cost &stored = cell_costs.data[level];
+    uint8_t &count = id_to_counts_[id][level];
+    // Average the first observations, weight by forget factor afterwards.
+    const float weight = std::max(forget_factor_, 1.f / (count + 1));
+    stored = std::isfinite(stored) ? fuse<F>(stored, cost, weight) : cost;
+    updateTotal(id);
+    if (count < MAX_COUNT) {
+      ++count;
+    }
+    return stored;
+  }
+
+  /**
+   * Fuse a batch of observations of a layer, with the fusion policy
+   * dispatched once per batch. Non-finite costs are skipped, the others are
+   * replaced by the fused costs.
+   */
+  void updateCellCosts(const std::vector<Cell> &cells, int level,
+                       std::vector<Cost> &costs) {
+    switch (fusions_[level]) {
+    case Fusion::MAX:
+      return updateCellCosts<Fusion::MAX>(cells, level, costs);
+    case Fusion::MIN:
+      return updateCellCosts<Fusion::MIN>(cells, level, costs);
+    case Fusion::LOG_ODDS:
+      return updateCellCosts<Fusion::LOG_ODDS>(cells, level, costs);
+    case Fusion::OVERWRITE:
+      return updateCellCosts<Fusion::OVERWRITE>(cells, level, costs);
+    default:
+      return updateCellCosts<Fusion::EMA>(cells, level, costs);
     }
-    return costs;
   }
-  Costs &updatePointCost(Point2f p, int level, Cost cost) {
+  template <Fusion F>
+  void updateCellCosts(const std::vector<Cell> &cells, int level,
+                       std::vector<Cost> &costs) {
+    assert(cells.size() == costs.size());
+    for (size_t i = 0; i < cells.size(); ++i) {
+      if (std::isfinite(costs[i])) {
+        costs[i] = updateCellCost<F>(cells[i], level, costs[i]);
+      }
+    }
+  }
+  Cost updatePointCost(Point2f p, int level, Cost cost) {
     return updateCellCost(pointToCell(p), level, cost);
   }
   float cellSize() const { return cell_size_; }
 
+  /**
+   * Store the layer in cells 2^shift times larger, sampled by cells they
+   * cover. Observations of the layer do not create cells. Must be set on an
+   * empty grid.
+   */
+  void setLayerShift(int level, uint8_t shift) {
+    assert(empty());
+    layer_shifts_[level] = shift;
+    coarse_layers_ &= ~(1 << level);
+    coarse_layers_ |= (shift ? 1 : 0) << level;
+    varying_layers_ = decaying_layers_ | coarse_layers_;
+  }
+  uint8_t layerShift(int level) const { return layer_shifts_[level]; }
+  /** Mask of layers stored at coarser resolution. */
+  uint8_t coarseLayers() const { return coarse_layers_; }
+  Cell coarseCell(const Cell &c, int level) const {
+    return Cell(c.x >> layer_shifts_[level], c.y >> layer_shifts_[level]);
+  }
+  /** Cost of a coarse layer covering the cell, default if not stored yet. */
+  Cost coarseCost(const Cell &c, int level) const {
+    const auto it = coarse_index_[level].find(coarseCell(c, level));
+    return it != coarse_index_[level].end() ? coarse_costs_[level][it->second]
+                                            : default_costs_[level];
+  }
+  /**
+   * Overwrite the coarse layer covering the cell, touching the tiles it
+   * covers and marking the cells under it changed.
+   */
+  void setCoarseCost(const Cell &c, int level, Cost cost) {
+    const uint32_t i = coarseIndex(c, level);
+    coarse_costs_[level][i] = cost;
+    coarseChanged(level, i);
+  }
+  /** Index of the coarse cell of the layer covering the cell, if stored. */
+  std::optional<uint32_t> findCoarse(const Cell &c, int level) const {
+    const auto it = coarse_index_[level].find(coarseCell(c, level));
+    if (it == coarse_index_[level].end()) {
+      return std::nullopt;
+    }
+    return it->second;
+  }
+  /** Reset the coarse cell to the default cost of the layer. */
+  void resetCoarse(int level, uint32_t i) {
+    coarse_costs_[level][i] = default_costs_[level];
+    coarseChanged(level, i);
+  }
+  /** Number of coarse cells stored for the layer. */
+  size_t coarseSize(int level) const { return coarse_costs_[level].size(); }
+  /** Coarse cell and its cost by index, see coarseSize(). */
+  const Cell &coarseCellAt(int level, uint32_t i) const {
+    return coarse_cells_[level][i].cell;
+  }
+  Cost coarseCostAt(int level, uint32_t i) const {
+    return coarse_costs_[level][i];
+  }
+
+  /**
+   * Layers decay toward default costs with given time constants, lazily on
+   * read from the time since the last update of the cell. Non-positive or NaN
+   * time constants disable decay of a layer.
+   */
+  void setDecayTimes(const Costs &decay_times) {
+    decay_times_ = decay_times;
+    decaying_layers_ = 0;
+    for (size_t i = 0; i < decay_times_.size(); ++i) {
+      if (decay_times_[i] > 0 && std::isfinite(default_costs_[i])) {
+        decaying_layers_ |= 1 << i;
+      }
+    }
+    decays_ = decaying_layers_ != 0;
+    varying_layers_ = decaying_layers_ | coarse_layers_;
+    updateTotals();
+  }
+  bool decays() const { return decays_; }
+  /** Mask of layers which decay, changing without any update or mark. */
+  uint8_t decayingLayers() const { return decaying_layers_; }
+  /** Time in seconds used for cell stamps and decay. */
+  void setTime(float time) { time_ = time; }
+  float time() const { return time_; }
+  float cellStamp(CellId id) const { return id_to_stamp_[id]; }
+
+  /**
+   * Max costs of traversable cells, cells exceeding these have infinite
+   * traversal cost.
+   */
+  void setMaxCosts(const Costs &max_costs) {
+    max_costs_ = max_costs;
+    bounded_layers_ = 0;
+    for (int i = 0; i < 4 && std::isfinite(max_costs_[i]); ++i) {
+      bounded_layers_ |= 1 << i;
+    }
+    updateTotals();
+  }
+  const Costs &maxCosts() const { return max_costs_; }
+  /**
+   * Total current cost of the cell, infinite if not within max costs.
+   * Totals of layers which neither decay nor are coarse are kept up to date
+   * by updates, direct writes to costs must call updateTotal(). Decaying and
+   * coarse layers are added on each call.
+   */
+  Cost traversalCost(CellId id) const {
+    Cost total = id_to_total_[id];
+    if (!varying_layers_ || std::isinf(total)) {
+      return total;
+    }
+    const float dt = time_ - id_to_stamp_[id];
+    for (int i = 0; i < 4; ++i) {
+      if (!(varying_layers_ & (1 << i))) {
+        continue;
+      }
+      Cost c;
+      if (layer_shifts_[i]) {
+        c = coarse_costs_[i][id_to_coarse_[i][id]];
+      } else {
+        c = costs(id)[i];
+        if (dt > 0 && std::isfinite(c)) {
+          c = default_costs_[i] +
+              (c - default_costs_[i]) * std::exp(-dt / decay_times_[i]);
+        }
+      }
+      if ((bounded_layers_ & (1 << i)) && !(c <= max_costs_[i])) {
+        return std::numeric_limits<Cost>::infinity();
+      }
+      if (!std::isnan(c)) {
+        total += c;
+      }
+    }
+    return total;
+  }
+  void updateTotal(CellId id) {
+    const Costs &c = costs(id);
+    Cost total = 0;
+    for (int i = 0; i < 4; ++i) {
+      if (varying_layers_ & (1 << i)) {
+        continue;
+      }
+      if ((bounded_layers_ & (1 << i)) && !(c[i] <= max_costs_[i])) {
+        total = std::numeric_limits<Cost>::infinity();
+        break;
+      }
+      if (!std::isnan(c[i])) {
+        total += c[i];
+      }
+    }
+    id_to_total_[id] = total;
+  }
+
+  /** True if stored costs are current, with no decay or coarse layers. */
+  bool rawCosts() const { return !decays_ && !coarse_layers_; }
+  /** Costs of the cell decayed to the current time, coarse layers sampled. */
+  Costs currentCosts(CellId id) const {
+    Costs c = costs(id);
+    for (int l = 0; coarse_layers_ && l < 4; ++l) {
+      if (layer_shifts_[l]) {
+        c[l] = coarse_costs_[l][id_to_coarse_[l][id]];
+      }
+    }
+    if (decays_) {
+      decay(id, c);
+    }
+    return c;
+  }
+
+  static constexpr uint8_t MAX_COUNT = 255;
+  static constexpr CellId REMOVED = std::numeric_limits<CellId>::max();
+  /** Number of observations of the layer in the cell, saturated. */
+  uint8_t observations(CellId id, int level) const {
+    return id_to_counts_[id][level];
+  }
+  /** True if any layer of the cell has been observed. */
+  bool observed(CellId id) const {
+    const auto &n = id_to_counts_[id];
+    return (n[0] | n[1] | n[2] | n[3]) != 0;
+  }
+  /** Count a layer as observed at least once, e.g., when loaded. */
+  void markObserved(CellId id, int level) {
+    uint8_t &count = id_to_counts_[id][level];
+    count = std::max(count, uint8_t(1));
+  }
+
+  /** Reset a layer of the cell to its default cost, as if never observed. */
+  void resetLayer(CellId id, int level) {
+    touchTile(cellToTile(cell(id)));
+    markChanged(id);
+    id_to_counts_[id][level] = 0;
+    if (layer_shifts_[level]) {
+      const uint32_t i = id_to_coarse_[level][id];
+      coarse_costs_[level][i] = default_costs_[level];
+      coarseChanged(level, i);
+      return;
+    }
+    stampCosts(id)[level] = default_costs_[level];
+    updateTotal(id);
+  }
+
+  /**
+   * Reset masked layers of the cell to default costs. Coarse layers are reset
+   * for the whole coarse cell.
+   * @return True if the cell or any of its coarse layers was stored.
+   */
+  bool resetCell(const Cell &c, uint8_t layers) {
+    if (hasCell(c)) {
+      const CellId id = cell_to_id_.find(c)->second;
+      markChanged(id);
+      for (int l = 0; l < 4; ++l) {
+        if (layers & (1 << l)) {
+          resetLayer(id, l);
+        }
+      }
+      return true;
+    }
+    bool reset = false;
+    for (int l = 0; l < 4; ++l) {
+      if (!(layers & coarse_layers_ & (1 << l))) {
+        continue;
+      }
+      const auto it = coarse_index_[l].find(coarseCell(c, l));
+      if (it != coarse_index_[l].end()) {
+        coarse_costs_[l][it->second] = default_costs_[l];
+        coarseChanged(l, it->second);
+        reset = true;
+      }
+    }
+    return reset;
+  }
+
+  /** Costs of the cell for writing, with decay applied and stamp renewed. */
+  Costs &stampCosts(CellId id) {
+    if (decays_) {
+      decay(id, costs(id));
+    }
+    id_to_stamp_[id] = time_;
+    return costs(id);
+  }
+
+  /**
+   * Integral of total cost along a line segment, sampled at half the cell
+   * size. Unknown cells have default costs.
+   */
+  Cost lineIntegral(const Point2f &a, const Point2f &b) const {
+    const float length = std::hypot(b.x - a.x, b.y - a.y);
+    const int n = std::max(1, int(std::ceil(2 * length / cell_size_)));
+    Cost sum = 0;
+    for (int i = 0; i < n; ++i) {
+      const float t = (i + 0.5f) / n;
+      const auto it = cell_to_id_.find(
+          pointToCell({a.x + t * (b.x - a.x), a.y + t * (b.y - a.y)}));
+      sum += (it != cell_to_id_.end() ? currentCosts(it->second)
+                                      : default_costs_)
+                 .total();
+    }
+    return sum * length / n;
+  }
+  void setTileLoader(const TileLoader &loader) { tile_loader_ = loader; }
+
+  // Epoch is advanced with every batch of updates and survives clearing.
+  uint32_t epoch() const { return epoch_; }
+  void setEpoch(uint32_t epoch) { epoch_ = epoch; }
+  uint32_t advanceEpoch() { return ++epoch_; }
+
+  // Epoch of the last update of any cell within the tile.
+  void touchTile(const Tile &t) {
+    if (last_tile_ == t && last_tile_epoch_ == epoch_) {
+      return;
+    }
+    tile_epochs_[t] = epoch_;
+    last_tile_ = t;
+    last_tile_epoch_ = epoch_;
+  }
+  uint32_t tileEpoch(const Tile &t) const {
+    const auto it = tile_epochs_.find(t);
+    return it != tile_epochs_.end() ? it->second : clear_epoch_;
+  }
+  const std::unordered_map<Tile, uint32_t, TileHasher> &tileEpochs() const {
+    return tile_epochs_;
+  }
+
+  // Cells created or updated since the changed cells were last taken, each
+  // listed once. Direct writes to costs must be marked explicitly.
+  void markChanged(CellId id) {
+    assert(id < size());
+    if (!changed_[id]) {
+      changed_[id] = 1;
+      changed_cells_.push_back(id);
+    }
+  }
+  void takeChangedCells(std::vector<CellId> &cells) {
+    cells.clear();
+    cells.swap(changed_cells_);
+    for (const auto &id : cells) {
+      changed_[id] = 0;
+    }
+    for (const auto &level_index : changed_coarse_) {
+      coarse_cells_[level_index.first][level_index.second].changed = false;
+    }
+    changed_coarse_.clear();
+  }
+  size_t numChangedCells() const { return changed_cells_.size(); }
+
   bool empty() const { return id_to_costs_.empty(); }
   size_t size() const { return id_to_costs_.size(); }
+
+  /**
+   * Remove cells and compact the remaining ones to consecutive ids, keeping
+   * their order. Arrays indexed by CellId shrink with the live cells.
+   * Changed cells are remapped, removed ones dropped, and tiles of removed
+   * cells are touched.
+   * @return Old to new CellId, REMOVED for removed cells.
+   */
+  std::vector<CellId> removeCells(const std::vector<CellId> &ids) {
+    std::vector<CellId> remap(size(), 0);
+    for (const auto &id : ids) {
+      remap[id] = REMOVED;
+    }
+    CellId n = 0;
+    for (CellId id = 0; id < size(); ++id) {
+      if (remap[id] == REMOVED) {
+        touchTile(cellToTile(id_to_cell_[id]));
+        cell_to_id_.erase(id_to_cell_[id]);
+        continue;
+      }
+      remap[id] = n;
+      if (n != id) {
+        cell_to_id_[id_to_cell_[id]] = n;
+        id_to_cell_[n] = id_to_cell_[id];
+        id_to_costs_[n] = id_to_costs_[id];
+        id_to_total_[n] = id_to_total_[id];
+        id_to_stamp_[n] = id_to_stamp_[id];
+        id_to_counts_[n] = id_to_counts_[id];
+        changed_[n] = changed_[id];
+        for (int l = 0; l < 4; ++l) {
+          if (layer_shifts_[l]) {
+            id_to_coarse_[l][n] = id_to_coarse_[l][id];
+          }
+        }
+      }
+      ++n;
+    }
+    const auto shrink = [n](auto &v) {
+      v.resize(n);
+      v.shrink_to_fit();
+    };
+    shrink(id_to_cell_);
+    shrink(id_to_costs_);
+    shrink(id_to_total_);
+    shrink(id_to_stamp_);
+    shrink(id_to_counts_);
+    shrink(changed_);
+    for (int l = 0; l < 4; ++l) {
+      if (layer_shifts_[l]) {
+        shrink(id_to_coarse_[l]);
+      }
+    }
+    for (int l = 0; l < 4; ++l) {
+      for (auto &coarse : coarse_cells_[l]) {
+        size_t k = 0;
+        for (const auto &id : coarse.cells) {
+          if (remap[id] != REMOVED) {
+            coarse.cells[k++] = remap[id];
+          }
+        }
+        coarse.cells.resize(k);
+      }
+    }
+    size_t k = 0;
+    for (const auto &id : changed_cells_) {
+      if (remap[id] != REMOVED) {
+        changed_cells_[k++] = remap[id];
+      }
+    }
+    changed_cells_.resize(k);
+    return remap;
+  }
   void clear() {
+    clear_epoch_ = ++epoch_;
     id_to_costs_.clear();
+    id_to_total_.clear();
+    id_to_stamp_.clear();
+    id_to_counts_.clear();
+    for (int l = 0; l < 4; ++l) {
+      coarse_index_[l].clear();
+      coarse_costs_[l].clear();
+      coarse_cells_[l].clear();
+      id_to_coarse_[l].clear();
+    }
+    changed_coarse_.clear();
     id_to_cell_.clear();
     cell_to_id_.clear();
+    changed_.clear();
+    changed_cells_.clear();
+    tile_epochs_.clear();
+    last_tile_epoch_ = 0;
   }
 
 protected:
+  void updateTotals() {
+    for (CellId id = 0; id < size(); ++id) {
+      updateTotal(id);
+    }
+  }
+
+  void decay(CellId id, Costs &c) const {
+    const float dt = time_ - id_to_stamp_[id];
+    if (!(dt > 0)) {
+      return;
+    }
+    for (size_t i = 0; i < c.size(); ++i) {
+      if (decay_times_[i] > 0 && !layer_shifts_[i] && std::isfinite(c[i]) &&
+          std::isfinite(default_costs_[i])) {
+        c[i] = default_costs_[i] +
+               (c[i] - default_costs_[i]) * std::exp(-dt / decay_times_[i]);
+      }
+    }
+  }
+
+  uint32_t coarseIndex(const Cell &c, int level) {
+    const Cell coarse = coarseCell(c, level);
+    const auto it = coarse_index_[level].find(coarse);
+    if (it != coarse_index_[level].end()) {
+      return it->second;
+    }
+    const uint32_t i = uint32_t(coarse_costs_[level].size());
+    coarse_index_[level][coarse] = i;
+    coarse_costs_[level].push_back(default_costs_[level]);
+    coarse_cells_[level].push_back({coarse, {}, NO_EPOCH, false});
+    return i;
+  }
+
+  /**
+   * Touch tiles covered by the coarse cell and mark cells under it changed,
+   * once per epoch and per taking changed cells, respectively.
+   */
+  void coarseChanged(int level, uint32_t i) {
+    CoarseCell &coarse = coarse_cells_[level][i];
+    if (coarse.epoch != epoch_) {
+      coarse.epoch = epoch_;
+      const int shift = layer_shifts_[level];
+      if (shift <= TILE_BITS) {
+        touchTile(Tile(coarse.cell.x >> (TILE_BITS - shift),
+                       coarse.cell.y >> (TILE_BITS - shift)));
+      } else {
+        const int n = 1 << (shift - TILE_BITS);
+        for (int dx = 0; dx < n; ++dx) {
+          for (int dy = 0; dy < n; ++dy) {
+            touchTile(Tile(coarse.cell.x * n + dx, coarse.cell.y * n + dy));
+          }
+        }
+      }
+    }
+    if (!coarse.changed) {
+      coarse.changed = true;
+      changed_coarse_.emplace_back(uint8_t(level), i);
+      for (const auto &id : coarse.cells) {
+        markChanged(id);
+      }
+    }
+  }
+
   float cell_size_;
   float forget_factor_;
   Costs default_costs_;
+  Costs max_costs_;
+  Fusion fusions_[4]{Fusion::EMA, Fusion::EMA, Fusion::EMA, Fusion::EMA};
+  Costs decay_times_;
+  bool decays_{false};
+  uint8_t decaying_layers_{0};
+  // Layers left out of stored totals, decaying or coarse
+  uint8_t varying_layers_{0};
+  // Layers checked against max costs, up to the first non-finite max cost
+  uint8_t bounded_layers_{0};
+  float time_{0.f};
+  TileLoader tile_loader_;
+  uint32_t epoch_{0};
+  uint32_t clear_epoch_{0};
+
+  // Tile to epoch of its last update
+  std::unordered_map<Tile, uint32_t, TileHasher> tile_epochs_;
+  Tile last_tile_;
+  uint32_t last_tile_epoch_{0};
 
   // CellId to Costs
   std::vector<Costs> id_to_costs_;
+  // CellId to total cost of layers not varying, infinite if not within max
+  // costs
+  std::vector<Cost> id_to_total_;
+  // CellId to time of the last update
+  std::vector<float> id_to_stamp_;
+  // CellId to saturated number of observations per layer
+  std::vector<std::array<uint8_t, 4>> id_to_counts_;
+  // Layers stored in coarser cells: shift, coarse cell index and costs,
+  // and CellId to coarse index
+  uint8_t layer_shifts_[4]{0, 0, 0, 0};
+  uint8_t coarse_layers_{0};
+  std::unordered_map<Cell, uint32_t, CellHasher> coarse_index_[4];
+  std::vector<Cost> coarse_costs_[4];
+  std::vector<uint32_t> id_to_coarse_[4];
+  // Coarse index to coarse cell, cells under it, epoch its tiles were last
+  // touched, and changed flag, with the changed ones listed
+  static constexpr uint32_t NO_EPOCH = std::numeric_limits<uint32_t>::max();
+  struct CoarseCell {
+    Cell cell;
+    std::vector<CellId> cells;
+    uint32_t epoch;
+    bool changed;
+  };
+  std::vector<CoarseCell> coarse_cells_[4];
+  std::vector<std::pair<uint8_t, uint32_t>> changed_coarse_;
   // CellId to Cell
   std::vector<Cell> id_to_cell_;
   // Cell to CellId
-  std::unordered_map<Cell, CellId, CellHasher> cell_to_id_;
+  std::unordered_map<Cell, CellId, CellHasher, std::equal_to<Cell>,
+                     PoolAllocator<std::pair<const Cell, CellId>>>
+      cell_to_id_;
+  // CellId to changed flag
+  std::vector<uint8_t> changed_;
+  std::vector<CellId> changed_cells_;
 };
 
 } // namespace grid
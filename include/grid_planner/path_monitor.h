@@ -0,0 +1,127 @@
+#pragma once
+
+#include "graph.h"
+#include "grid.h"
+#include <cmath>
+#include <limits>
+#include <unordered_set>
+#include <vector>
+
+namespace naex {
+namespace grid {
+
+/** Cost of the edge between neighbor vertices, infinite if not neighbors. */
+inline Cost edgeCost(const Graph &graph, VertexId u, VertexId v) {
+  auto edges = graph.out_edges(u);
+  for (auto it = edges.first; it != edges.second; ++it) {
+    if (graph.target(*it) == v) {
+      return graph.cost(*it);
+    }
+  }
+  return Graph::INF;
+}
+
+/**
+ * Last path watched for changes, so that it can be reused instead of
+ * planning again.
+ *
+ * Cells along the path and within a margin of it are watched, the path is
+ * dropped once any of these changes or is created. The remaining cost is
+ * also compared to the planned one, which covers costs written directly.
+ */
+class PathMonitor {
+public:
+  bool empty() const { return path_.empty(); }
+  const std::vector<VertexId> &path() const { return path_; }
+  bool sameGoal(const Cell &goal, float tolerance) const {
+    return !empty() && goal_ == goal && tolerance_ == tolerance;
+  }
+
+  void clear() {
+    path_.clear();
+    costs_.clear();
+    cells_.clear();
+  }
+
+  template <typename Vertices>
+  void reset(const Graph &graph, const Grid &grid, const Vertices &path,
+             int margin, const Cell &goal, float tolerance) {
+    clear();
+    path_.assign(path.begin(), path.end());
+    goal_ = goal;
+    tolerance_ = tolerance;
+    costs_.reserve(path_.size());
+    Cost cost = 0;
+    for (size_t i = 0; i < path_.size(); ++i) {
+      if (i > 0) {
+        cost += edgeCost(graph, path_[i - 1], path_[i]);
+      }
+      costs_.push_back(cost);
+      const Cell &c = grid.cell(path_[i]);
+      for (int dx = -margin; dx <= margin; ++dx) {
+        for (int dy = -margin; dy <= margin; ++dy) {
+          cells_.insert(Cell(c.x + dx, c.y + dy));
+        }
+      }
+    }
+  }
+
+  /** Drop the path if any of the changed cells is watched. */
+  void update(const Grid &grid, const std::vector<CellId> &changed) {
+    if (empty()) {
+      return;
+    }
+    for (const auto &v : changed) {
+      if (cells_.find(grid.cell(v)) != cells_.end()) {
+        clear();
+        return;
+      }
+    }
+  }
+
+  /**
+   * Remaining path from the path vertex closest to the position.
+   * @param max_dist Max distance of the position from the path.
+   * @param cost_tolerance Max relative difference of the remaining cost from
+   * the planned one.
+   * @return Remaining path vertices, empty if the path is not valid.
+   */
+  std::vector<VertexId> remaining(const Graph &graph, const Grid &grid,
+                                  const Point2f &p, float max_dist,
+                                  float cost_tolerance) const {
+    size_t k = 0;
+    float best_dist = std::numeric_limits<float>::infinity();
+    for (size_t i = 0; i < path_.size(); ++i) {
+      const Point2f q = grid.point(path_[i]);
+      const float dist = std::hypot(q.x - p.x, q.y - p.y);
+      if (dist < best_dist) {
+        k = i;
+        best_dist = dist;
+      }
+    }
+    if (!(best_dist <= max_dist)) {
+      return {};
+    }
+    Cost cost = 0;
+    for (size_t i = k + 1; i < path_.size(); ++i) {
+      cost += edgeCost(graph, path_[i - 1], path_[i]);
+    }
+    const Cost planned = costs_.back() - costs_[k];
+    if (!(std::abs(cost - planned) <= cost_tolerance * planned)) {
+      return {};
+    }
+    return std::vector<VertexId>(path_.begin() + k, path_.end());
+  }
+
+protected:
+  std::vector<VertexId> path_;
+  // Path cost from the first vertex
+  std::vector<Cost> costs_;
+  // Watched cells
+  std::unordered_set<Cell, CellHasher> cells_;
+  Cell goal_;
+  float tolerance_{0.f};
+};
+
+} // namespace grid
+} // namespace naex
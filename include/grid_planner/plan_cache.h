@@ -0,0 +1,150 @@
+#pragma once
+
+#include "graph.h"
+#include "grid.h"
+#include "hash.h"
+#include <list>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace naex {
+namespace grid {
+
+/** Planning request as seen by the search. */
+struct PlanKey {
+  Cell start;
+  Cell goal;
+  // Hash of search parameters, e.g., neighborhood and max costs.
+  size_t params;
+
+  bool operator==(const PlanKey &other) const {
+    return start == other.start && goal == other.goal &&
+           params == other.params;
+  }
+};
+
+struct PlanKeyHasher {
+  std::size_t operator()(const PlanKey &key) const {
+    std::size_t seed = key.params;
+    hash_combine(seed, key.start.x);
+    hash_combine(seed, key.start.y);
+    hash_combine(seed, key.goal.x);
+    hash_combine(seed, key.goal.y);
+    return seed;
+  }
+};
+
+inline size_t searchParamsHash(uint8_t neighborhood, const Costs &max_costs) {
+  size_t seed = 0;
+  hash_combine(seed, neighborhood);
+  for (int i = 0; i < 4; ++i) {
+    hash_combine(seed, max_costs[i]);
+  }
+  return seed;
+}
+
+/**
+ * Least recently used plan results.
+ *
+ * A plan is valid while the grid epoch does not change, or, if only path
+ * tiles are checked, while no tile along the path or next to it changes.
+ * The latter keeps valid paths which may no longer be the shortest ones.
+ */
+class PlanCache {
+public:
+  struct Plan {
+    PlanKey key;
+    // Grid epoch the plan was computed at.
+    uint32_t epoch;
+    std::vector<VertexId> path;
+    std::unordered_set<Tile, TileHasher> tiles;
+  };
+
+  PlanCache(size_t capacity = 16, bool path_tiles = false)
+      : capacity_(capacity), path_tiles_(path_tiles) {}
+
+  /** Return a valid plan for the key, counting hits and misses. */
+  const Plan *find(const Grid &grid, const PlanKey &key) {
+    const auto it = index_.find(key);
+    if (it == index_.end()) {
+      ++misses_;
+      return nullptr;
+    }
+    if (!valid(grid, *it->second)) {
+      plans_.erase(it->second);
+      index_.erase(it);
+      ++misses_;
+      return nullptr;
+    }
+    plans_.splice(plans_.begin(), plans_, it->second);
+    ++hits_;
+    return &plans_.front();
+  }
+
+  template <typename Vertices>
+  void insert(const Grid &grid, const PlanKey &key, const Vertices &path) {
+    if (capacity_ == 0) {
+      return;
+    }
+    const auto it = index_.find(key);
+    if (it != index_.end()) {
+      plans_.erase(it->second);
+      index_.erase(it);
+    }
+    plans_.push_front(
+        {key, grid.epoch(), std::vector<VertexId>(path.begin(), path.end()),
+         {}});
+    if (path_tiles_) {
+      auto &tiles = plans_.front().tiles;
+      for (const auto &v : path) {
+        const Tile t = cellToTile(grid.cell(v));
+        if (tiles.insert(t).second) {
+          for (int i = 0; i < 8; ++i) {
+            tiles.insert(neighbor8(t, i));
+          }
+        }
+      }
+    }
+    index_[key] = plans_.begin();
+    if (plans_.size() > capacity_) {
+      index_.erase(plans_.back().key);
+      plans_.pop_back();
+    }
+  }
+
+  void clear() {
+    plans_.clear();
+    index_.clear();
+  }
+
+  size_t hits() const { return hits_; }
+  size_t misses() const { return misses_; }
+  float hitRate() const {
+    return hits_ + misses_ > 0 ? float(hits_) / (hits_ + misses_) : 0.f;
+  }
+
+protected:
+  bool valid(const Grid &grid, const Plan &plan) const {
+    if (!path_tiles_) {
+      return plan.epoch == grid.epoch();
+    }
+    for (const auto &t : plan.tiles) {
+      if (grid.tileEpoch(t) > plan.epoch) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  size_t capacity_;
+  bool path_tiles_;
+  std::list<Plan> plans_;
+  std::unordered_map<PlanKey, std::list<Plan>::iterator, PlanKeyHasher>
+      index_;
+  size_t hits_{0};
+  size_t misses_{0};
+};
+
+} // namespace grid
+} // namespace naex
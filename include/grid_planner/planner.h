@@ -1,19 +1,41 @@
 #pragma once
 
+#include "allocators.h"
+#include "alternatives.h"
 #include "clouds.h"
+#include "components.h"
+#include "cost_to_go.h"
+#include "frontier.h"
 #include "graph.h"
 #include "grid.h"
 #include "iterators.h"
+#include "path_monitor.h"
+#include "plan_cache.h"
+#include "raster.h"
 #include "search.h"
+#include "snapshot.h"
+#include "tile_store.h"
+#include "tiles.h"
+#include "timing_wheel.h"
 #include "timer.h"
 #include "transforms.h"
 #include "types.h"
+#include "update_log.h"
+#include <deque>
 #include <functional>
 #include <geometry_msgs/msg/pose_stamped.hpp>
 #include <geometry_msgs/msg/transform_stamped.hpp>
+#include <grid_planner/msg/map_delta.hpp>
+#include <grid_planner/srv/clear_region.hpp>
+#include <grid_planner/srv/export_cost_field.hpp>
+#include <grid_planner/srv/get_alternative_plans.hpp>
+#include <grid_planner/srv/get_plans.hpp>
+#include <grid_planner/srv/query_cost_to_go.hpp>
+#include <grid_planner/srv/query_costs.hpp>
 #include <nav2_msgs/srv/clear_entire_costmap.hpp>
 #include <nav_msgs/msg/path.hpp>
 #include <nav_msgs/srv/get_plan.hpp>
+#include <numeric>
 #include <rclcpp/rclcpp.hpp>
 #include <sensor_msgs/msg/point_cloud2.hpp>
 #include <sensor_msgs/point_cloud2_iterator.hpp>
@@ -22,6 +44,7 @@
 #include <tf2_ros/buffer.h>
 #include <tf2_ros/transform_listener.h>
 #include <unordered_map>
+#include <unordered_set>
 
 namespace naex {
 namespace grid {
@@ -45,28 +68,8 @@ Vec3 toVec3(const geometry_msgs::msg::Vector3 &v) {
 }
 Vec3 toVec3(const Point2f &v) { return Vec3(v.x, v.y, 0.f); }
 
-void tracePathVertices(VertexId v0, VertexId v1,
-                       const std::vector<VertexId> &predecessor,
-                       std::vector<VertexId> &path_vertices) {
-  assert(predecessor[v0] == v0);
-  Vertex v = v1;
-  while (v != v0) {
-    path_vertices.push_back(v);
-    v = predecessor[v];
-  }
-  path_vertices.push_back(v);
-  std::reverse(path_vertices.begin(), path_vertices.end());
-}
-
-std::vector<VertexId>
-tracePathVertices(VertexId v0, VertexId v1,
-                  const std::vector<VertexId> &predecessor) {
-  std::vector<VertexId> path_vertices;
-  tracePathVertices(v0, v1, predecessor, path_vertices);
-  return path_vertices;
-}
-
-void appendPath(const std::vector<VertexId> &path_vertices, const Grid &grid,
+template <typename Vertices>
+void appendPath(const Vertices &path_vertices, const Grid &grid,
                 nav_msgs::msg::Path &path) {
   if (path_vertices.empty()) {
     return;
@@ -110,6 +113,17 @@ bool isValid(const geometry_msgs::msg::Vector3 &p) {
   return isValid(p.x, p.y, p.z);
 }
 
+/** Robot planned for on the shared grid, besides the main robot frame. */
+struct Robot {
+  std::string frame;
+  nav_msgs::srv::GetPlan::Request::SharedPtr request;
+  nav_msgs::msg::Path plan;
+  // Search workspace of the last plan
+  std::shared_ptr<ShortestPaths> search;
+  rclcpp::Publisher<nav_msgs::msg::Path>::SharedPtr path_pub;
+  rclcpp::Service<nav_msgs::srv::GetPlan>::SharedPtr get_plan_service;
+};
+
 /**
  * @brief Global planner on 2D grid.
  *
@@ -119,7 +133,8 @@ bool isValid(const geometry_msgs::msg::Vector3 &p) {
  */
 class Planner {
 public:
-  Planner(rclcpp::Node::SharedPtr nh) : nh_(nh) {
+  Planner(rclcpp::Node::SharedPtr nh)
+      : nh_(nh), start_time_(nh->get_clock()->now()) {
     // Invalid position invokes exploration mode.
     last_request_ = std::make_shared<nav_msgs::srv::GetPlan::Request>();
     last_request_->start.pose.position.x =
@@ -147,6 +162,8 @@ public:
     map_frame_ = nh_->declare_parameter<std::string>("map_frame", map_frame_);
     robot_frame_ =
         nh_->declare_parameter<std::string>("robot_frame", robot_frame_);
+    robot_frames_ = nh_->declare_parameter<std::vector<std::string>>(
+        "robot_frames", robot_frames_);
     tf_timeout_ = nh_->declare_parameter<float>("tf_timeout", tf_timeout_);
 
     max_cloud_age_ =
@@ -175,6 +192,97 @@ public:
     default_costs_ = nh_->declare_parameter<std::vector<float>>("default_costs",
                                                                 default_costs);
     grid_ = Grid(cell_size, forget_factor, default_costs_);
+    grid_.setMaxCosts(max_costs_);
+    // Cell sizes of layers, power-of-two multiples of cell_size, or NaN.
+    std::vector<float> layer_cell_sizes(
+        default_costs.size(), std::numeric_limits<float>::quiet_NaN());
+    layer_cell_sizes = nh_->declare_parameter<std::vector<float>>(
+        "layer_cell_sizes", layer_cell_sizes);
+    for (int l = 0; l < std::min(4, int(layer_cell_sizes.size())); ++l) {
+      if (!(layer_cell_sizes[l] > cell_size)) {
+        continue;
+      }
+      const int shift = std::min(
+          15, int(std::round(std::log2(layer_cell_sizes[l] / cell_size))));
+      grid_.setLayerShift(l, uint8_t(shift));
+      if (std::abs(cell_size * (1 << shift) - layer_cell_sizes[l]) >
+          1e-3f * cell_size) {
+        RCLCPP_WARN(nh_->get_logger(),
+                    "Layer %i cell size %.3f m rounded to %.3f m.", l,
+                    layer_cell_sizes[l], cell_size * (1 << shift));
+      }
+    }
+    // Time constants of cost decay per layer in seconds, disabled if NaN.
+    std::vector<float> decay_times(default_costs.size(),
+                                   std::numeric_limits<float>::quiet_NaN());
+    decay_times =
+        nh_->declare_parameter<std::vector<float>>("decay_times", decay_times);
+    Costs grid_decay_times;
+    grid_decay_times = decay_times;
+    grid_.setDecayTimes(grid_decay_times);
+    // Fusion of observations per layer: ema, max, min, log_odds, overwrite.
+    std::vector<std::string> layer_fusion(default_costs.size(), "ema");
+    layer_fusion = nh_->declare_parameter<std::vector<std::string>>(
+        "layer_fusion", layer_fusion);
+    for (int l = 0; l < std::min(4, int(layer_fusion.size())); ++l) {
+      Fusion fusion = Fusion::EMA;
+      if (!parseFusion(layer_fusion[l], fusion)) {
+        RCLCPP_WARN(nh_->get_logger(),
+                    "Unknown fusion %s of layer %i, using ema.",
+                    layer_fusion[l].c_str(), l);
+      }
+      grid_.setFusion(l, fusion);
+    }
+
+    // Static map store loaded lazily
+    static_map_store_ = nh_->declare_parameter<std::string>(
+        "static_map_store", static_map_store_);
+    static_store_layers_ = nh_->declare_parameter<std::vector<long int>>(
+        "static_store_layers", static_store_layers_);
+    prefetch_radius_ =
+        nh_->declare_parameter<float>("prefetch_radius", prefetch_radius_);
+    prefetch_distance_ =
+        nh_->declare_parameter<float>("prefetch_distance", prefetch_distance_);
+    if (!static_map_store_.empty()) {
+      openStaticStore();
+    }
+
+    // Layer of transient obstacles reset when not observed within TTL, not
+    // persisted.
+    dynamic_layer_ =
+        nh_->declare_parameter<int>("dynamic_layer", dynamic_layer_);
+    dynamic_ttl_ = nh_->declare_parameter<float>("dynamic_ttl", dynamic_ttl_);
+    dynamic_expiry_ = TimingWheel(nh_->declare_parameter<float>(
+        "dynamic_expiry_resolution", dynamic_expiry_.resolution()));
+
+    // Map persistence
+    map_store_dir_ =
+        nh_->declare_parameter<std::string>("map_store_dir", map_store_dir_);
+    snapshot_period_ =
+        nh_->declare_parameter<float>("snapshot_period", snapshot_period_);
+    if (!map_store_dir_.empty()) {
+      restoreMap();
+    }
+
+    // Map deltas exchanged with other planners
+    delta_layers_ = nh_->declare_parameter<std::vector<long int>>(
+        "delta_layers", delta_layers_);
+    delta_period_ =
+        nh_->declare_parameter<float>("delta_period", delta_period_);
+    max_delta_tiles_ =
+        nh_->declare_parameter<int>("max_delta_tiles", max_delta_tiles_);
+    peer_layer_ = nh_->declare_parameter<int>("peer_layer", peer_layer_);
+
+    max_delta_cells_ =
+        nh_->declare_parameter<int>("max_delta_cells", max_delta_cells_);
+    for (const auto &layer : delta_layers_) {
+      if (layer < 0 || layer >= 4 || layer == peer_layer_) {
+        RCLCPP_WARN(nh_->get_logger(), "Layer %li not shared in map deltas.",
+                    layer);
+        continue;
+      }
+      delta_layer_mask_ |= 1 << layer;
+    }
 
     planning_freq_ =
         nh_->declare_parameter<float>("planning_freq", planning_freq_);
@@ -186,6 +294,28 @@ public:
     mode_ = nh_->declare_parameter<int>("mode", mode_);
     plan_to_goal_ =
         nh_->declare_parameter<bool>("plan_to_goal", plan_to_goal_);
+    cost_to_go_min_requests_ = nh_->declare_parameter<int>(
+        "cost_to_go_min_requests", cost_to_go_min_requests_);
+    path_check_margin_ =
+        nh_->declare_parameter<float>("path_check_margin", path_check_margin_);
+    path_cost_tolerance_ = nh_->declare_parameter<float>(
+        "path_cost_tolerance", path_cost_tolerance_);
+    alternative_max_stretch_ = nh_->declare_parameter<float>(
+        "alternative_max_stretch", alternative_max_stretch_);
+    alternative_max_overlap_ = nh_->declare_parameter<float>(
+        "alternative_max_overlap", alternative_max_overlap_);
+    redirect_goals_ =
+        nh_->declare_parameter<bool>("redirect_goals", redirect_goals_);
+    plan_cache_size_ =
+        nh_->declare_parameter<int>("plan_cache_size", plan_cache_size_);
+    plan_cache_path_tiles_ = nh_->declare_parameter<bool>(
+        "plan_cache_path_tiles", plan_cache_path_tiles_);
+    plan_cache_ = PlanCache(size_t(std::max(plan_cache_size_, 0)),
+                            plan_cache_path_tiles_);
+    min_frontier_size_ =
+        nh_->declare_parameter<int>("min_frontier_size", min_frontier_size_);
+    frontier_utility_weight_ = nh_->declare_parameter<float>(
+        "frontier_utility_weight", frontier_utility_weight_);
 
     // Ad-hoc cost parameters
     adhoc_costs_ = nh_->declare_parameter("adhoc_costs", adhoc_costs_);
@@ -210,6 +340,25 @@ public:
     path_pub_ = nh_->create_publisher<nav_msgs::msg::Path>("path", 2);
     planning_freq_pub_ =
         nh_->create_publisher<std_msgs::msg::Float32>("planning_freq", 2);
+    if (delta_layer_mask_ && delta_period_ > 0.f) {
+      map_delta_pub_ =
+          nh_->create_publisher<grid_planner::msg::MapDelta>("map_delta", 10);
+      delta_timer_ = nh_->create_wall_timer(
+          std::chrono::duration<double>(delta_period_),
+          std::bind(&Planner::publishMapDelta, this));
+    }
+    if (peer_layer_ >= 0 && peer_layer_ < 4) {
+      peer_map_delta_sub_ =
+          nh_->create_subscription<grid_planner::msg::MapDelta>(
+              "peer_map_delta", 10,
+              [this](const std::shared_ptr<const grid_planner::msg::MapDelta>
+                         &msg) { this->receiveMapDelta(msg); });
+      if (delta_period_ > 0.f) {
+        peer_delta_timer_ = nh_->create_wall_timer(
+            std::chrono::duration<double>(delta_period_),
+            std::bind(&Planner::mergePeerDeltas, this));
+      }
+    }
 
     for (int i = 0; i < num_input_clouds; ++i) {
       std::stringstream ss;
@@ -251,10 +400,266 @@ public:
             "clear_plan_map",
             std::bind(&Planner::clearMap, this, std::placeholders::_1,
                       std::placeholders::_2));
+    clear_region_service_ =
+        nh_->create_service<grid_planner::srv::ClearRegion>(
+            "clear_region",
+            std::bind(&Planner::clearRegion, this, std::placeholders::_1,
+                      std::placeholders::_2));
+    get_plans_service_ = nh_->create_service<grid_planner::srv::GetPlans>(
+        "get_plans", std::bind(&Planner::requestPlans, this,
+                               std::placeholders::_1, std::placeholders::_2));
+    get_alternative_plans_service_ =
+        nh_->create_service<grid_planner::srv::GetAlternativePlans>(
+            "get_alternative_plans",
+            std::bind(&Planner::requestAlternativePlans, this,
+                      std::placeholders::_1, std::placeholders::_2));
+    query_costs_service_ = nh_->create_service<grid_planner::srv::QueryCosts>(
+        "query_costs", std::bind(&Planner::queryCosts, this,
+                                 std::placeholders::_1, std::placeholders::_2));
+    query_cost_to_go_service_ =
+        nh_->create_service<grid_planner::srv::QueryCostToGo>(
+            "query_cost_to_go",
+            std::bind(&Planner::queryCostToGo, this, std::placeholders::_1,
+                      std::placeholders::_2));
+    export_cost_field_service_ =
+        nh_->create_service<grid_planner::srv::ExportCostField>(
+            "export_cost_field",
+            std::bind(&Planner::exportCostField, this, std::placeholders::_1,
+                      std::placeholders::_2));
+
+    // Other robots planned for on the shared grid
+    robots_.resize(robot_frames_.size());
+    for (size_t i = 0; i < robots_.size(); ++i) {
+      robots_[i].frame = robot_frames_[i];
+      robots_[i].path_pub = nh_->create_publisher<nav_msgs::msg::Path>(
+          "path_" + std::to_string(i), 2);
+      robots_[i].get_plan_service =
+          nh_->create_service<nav_msgs::srv::GetPlan>(
+              "get_plan_" + std::to_string(i),
+              [this, i](nav_msgs::srv::GetPlan::Request::SharedPtr req,
+                        nav_msgs::srv::GetPlan::Response::SharedPtr res) {
+                this->requestRobotPlan(i, req, res);
+              });
+    }
+    if (!robots_.empty() && planning_freq_ > 0.f) {
+      robots_timer_ = nh_->create_wall_timer(
+          std::chrono::duration<double>(1.0 / planning_freq_),
+          std::bind(&Planner::planRobots, this));
+    }
+
+    if (update_log_ && snapshot_period_ > 0.f) {
+      snapshot_timer_ = nh_->create_wall_timer(
+          std::chrono::duration<double>(snapshot_period_),
+          std::bind(&Planner::saveSnapshot, this));
+    }
 
     RCLCPP_INFO(nh_->get_logger(), "Node initialized.");
   }
 
+  /** Layers persisted in snapshots and the update log. */
+  uint8_t persistentLayerMask() const {
+    if (dynamic_layer_ >= 0 && dynamic_layer_ < 4) {
+      return ALL_LAYERS & ~(1 << dynamic_layer_);
+    }
+    return ALL_LAYERS;
+  }
+
+  uint8_t staticLayerMask() const {
+    uint8_t layers = 0;
+    for (const auto &layer : static_store_layers_) {
+      if (layer >= 0 && layer < 4) {
+        layers |= 1 << layer;
+      }
+    }
+    return layers;
+  }
+
+  /** Load tiles of the static store into the grid on first access. */
+  void openStaticStore() {
+    Timer t;
+    auto store = std::make_shared<TileStore>();
+    if (!store->open(static_map_store_, grid_.cellSize())) {
+      RCLCPP_ERROR(nh_->get_logger(),
+                   "Could not open static map store %s with cell size %.3f.",
+                   static_map_store_.c_str(), grid_.cellSize());
+      return;
+    }
+    tile_loader_ =
+        std::make_unique<LazyTileLoader>(store, staticLayerMask());
+    grid_.setTileLoader(
+        [this](const Tile &tile) { return tile_loader_->load(tile, grid_); });
+    RCLCPP_INFO(nh_->get_logger(),
+                "Static map store %s with %lu tiles opened (%.3f s).",
+                static_map_store_.c_str(), store->size(), t.seconds_elapsed());
+  }
+
+  /**
+   * Prefetch static tiles around the robot, ahead along its heading, along
+   * the previous path, and next to tiles reached by the search.
+   */
+  void prefetchStaticTiles(const geometry_msgs::msg::Pose &pose,
+                           const ShortestPaths &sp) {
+    const Grid &grid = grid_;
+    const float tile_size = TILE_SIZE * grid.cellSize();
+    const Point2f p0(pose.position.x, pose.position.y);
+    std::vector<Tile> tiles;
+    const auto add_tiles = [&tiles](const Tile &center, int radius) {
+      for (int dx = -radius; dx <= radius; ++dx) {
+        for (int dy = -radius; dy <= radius; ++dy) {
+          tiles.emplace_back(center.x + dx, center.y + dy);
+        }
+      }
+    };
+
+    add_tiles(cellToTile(grid.pointToCell(p0)),
+              int(std::ceil(prefetch_radius_ / tile_size)));
+
+    const auto &q = pose.orientation;
+    const float yaw = std::atan2(2.0f * (q.w * q.z + q.x * q.y),
+                                 1.0f - 2.0f * (q.y * q.y + q.z * q.z));
+    for (float d = tile_size; d <= prefetch_distance_; d += tile_size) {
+      const Point2f p(p0.x + d * std::cos(yaw), p0.y + d * std::sin(yaw));
+      add_tiles(cellToTile(grid.pointToCell(p)), 1);
+    }
+
+    Tile last_tile(std::numeric_limits<int16_t>::max(), 0);
+    for (const auto &path_pose : last_plan_.poses) {
+      const auto &p = path_pose.pose.position;
+      const Tile tile = cellToTile(grid.pointToCell({float(p.x), float(p.y)}));
+      if (!(tile == last_tile)) {
+        add_tiles(tile, 1);
+        last_tile = tile;
+      }
+    }
+
+    const auto &store = tile_loader_->store();
+    for (const auto &tile : tile_loader_->loadedTiles()) {
+      int reached = -1;
+      for (int i = 0; i < 8; ++i) {
+        const Tile next = neighbor8(tile, i);
+        if (!store.contains(next) || tile_loader_->loaded(next)) {
+          continue;
+        }
+        if (reached < 0) {
+          reached = 0;
+          for (int j = 0; j < TILE_CELLS && !reached; ++j) {
+            const Cell c = tileCell(tile, uint8_t(j));
+            reached = grid.hasCell(c) &&
+                      grid.cellId(c) < sp.pathCosts().size() &&
+                      std::isfinite(sp.pathCost(grid.cellId(c)));
+          }
+        }
+        if (reached) {
+          tiles.push_back(next);
+        }
+      }
+    }
+    tile_loader_->request(tiles);
+  }
+
+  std::string snapshotPath() const { return map_store_dir_ + "/map.snapshot"; }
+  std::string updateLogPath() const { return map_store_dir_ + "/map.log"; }
+  std::string costToGoPath() const {
+    return map_store_dir_ + "/cost_to_go.cache";
+  }
+
+  /** Load the last snapshot, replay the update log, and start logging. */
+  void restoreMap() {
+    Timer t;
+    const long num_tiles =
+        loadSnapshot(snapshotPath(), grid_, persistentLayerMask());
+    if (num_tiles < 0) {
+      RCLCPP_WARN(nh_->get_logger(), "No valid map snapshot %s loaded.",
+                  snapshotPath().c_str());
+    }
+    const uint32_t snapshot_epoch = grid_.epoch();
+    const size_t num_updates = replayUpdateLog(
+        updateLogPath(), snapshot_epoch, grid_, persistentLayerMask());
+    RCLCPP_INFO(nh_->get_logger(),
+                "Map restored from %ld tiles (epoch %u) and %lu logged "
+                "updates: %lu cells, epoch %u (%.3f s).",
+                std::max(num_tiles, 0L), snapshot_epoch, num_updates,
+                grid_.size(), grid_.epoch(), t.seconds_elapsed());
+
+    t.reset();
+    const long num_fields =
+        loadCostToGoCache(costToGoPath(), grid_, neighborhood_, max_costs_,
+                          staticLayerMask(), cost_to_go_);
+    RCLCPP_INFO(nh_->get_logger(),
+                "%li cached cost-to-go fields loaded (%.3f s).",
+                std::max(num_fields, 0L), t.seconds_elapsed());
+
+    update_log_ = std::make_unique<UpdateLog>(updateLogPath(), snapshotPath());
+    if (!update_log_->good()) {
+      RCLCPP_ERROR(nh_->get_logger(), "Could not open update log %s.",
+                   updateLogPath().c_str());
+      update_log_.reset();
+    }
+  }
+
+  /** Snapshot the grid, the update log is truncated once it is written. */
+  void saveSnapshot() {
+    if (!update_log_) {
+      return;
+    }
+    if (const size_t n = update_log_->takeFailedTruncations()) {
+      RCLCPP_ERROR(nh_->get_logger(),
+                   "Update log %s not truncated after %lu snapshots, "
+                   "appending to the old log.",
+                   updateLogPath().c_str(), n);
+    }
+    Timer t;
+    std::vector<uint8_t> snapshot;
+    encodeSnapshot(grid_, snapshot, persistentLayerMask());
+    const size_t size = snapshot.size();
+    UpdateLog::Files files(1);
+    files[0].first = costToGoPath();
+    encodeCostToGoCache(grid_, cost_to_go_, neighborhood_, max_costs_,
+                        staticLayerMask(), files[0].second);
+    update_log_->checkpoint(std::move(snapshot), std::move(files));
+    RCLCPP_INFO(nh_->get_logger(),
+                "Map snapshot at epoch %u encoded (%lu B, %.3f s).",
+                grid_.epoch(), size, t.seconds_elapsed());
+  }
+
+  /** Advance grid time, in seconds since node start, for cost decay. */
+  void updateGridTime() {
+    grid_.setTime(float((nh_->get_clock()->now() - start_time_).seconds()));
+    expireDynamicCells();
+  }
+
+  /**
+   * Id of the dynamic layer covering the cell in the expiry wheel, the cell
+   * id, or the coarse cell index for a coarse layer. None if not stored.
+   */
+  std::optional<uint32_t> expiryId(const Cell &c) const {
+    if (grid_.layerShift(dynamic_layer_)) {
+      return grid_.findCoarse(c, dynamic_layer_);
+    }
+    return grid_.findCell(c);
+  }
+
+  /** Reset the dynamic layer of cells not observed within TTL. */
+  void expireDynamicCells() {
+    size_t n = 0;
+    const bool coarse = dynamic_layer_ >= 0 && dynamic_layer_ < 4 &&
+                        grid_.layerShift(dynamic_layer_);
+    dynamic_expiry_.advance(grid_.time(), [this, &n, coarse](uint32_t id) {
+      // Invalidate plans using the expired cells.
+      if (n++ == 0) {
+        grid_.advanceEpoch();
+      }
+      if (coarse) {
+        grid_.resetCoarse(dynamic_layer_, id);
+      } else {
+        grid_.resetLayer(id, dynamic_layer_);
+      }
+    });
+    if (n > 0) {
+      RCLCPP_DEBUG(nh_->get_logger(), "%lu dynamic cells expired.", n);
+    }
+  }
+
   void startPlanning() {
     if (!(planning_freq_ > 0.f)) {
       RCLCPP_ERROR(nh_->get_logger(),
@@ -287,6 +692,137 @@ public:
     RCLCPP_WARN(nh_->get_logger(), "Planning stopped.");
   }
 
+  /** Robot pose in the map frame, unless the start position is valid. */
+  geometry_msgs::msg::PoseStamped
+  startPose(const geometry_msgs::msg::PoseStamped &start,
+            const std::string &robot_frame) {
+    geometry_msgs::msg::PoseStamped pose = start;
+    if (!isValid(pose.pose.position)) {
+      const auto tf =
+          tf_->lookupTransform(map_frame_, robot_frame, rclcpp::Time(0),
+                               rclcpp::Duration::from_seconds(tf_timeout_));
+      transform_to_pose(tf, pose);
+    }
+    if (mode_ == 2) {
+      pose.pose.position.z = 0.f;
+    }
+    return pose;
+  }
+  geometry_msgs::msg::PoseStamped
+  startPose(const geometry_msgs::msg::PoseStamped &start) {
+    return startPose(start, robot_frame_);
+  }
+
+  /**
+   * Load static tiles within the distance from the point, so that lookups
+   * around it find cells of tiles not loaded yet. Loading may add cells.
+   */
+  void loadTiles(const Vec3 &p, float dist = 0.f) {
+    if (!tile_loader_) {
+      return;
+    }
+    if (!(dist > 0.f) || !std::isfinite(dist)) {
+      dist = 0.f;
+    }
+    const Tile t0 = cellToTile(grid_.pointToCell({p.x() - dist, p.y() - dist}));
+    const Tile t1 = cellToTile(grid_.pointToCell({p.x() + dist, p.y() + dist}));
+    for (int x = t0.x; x <= t1.x; ++x) {
+      for (int y = t0.y; y <= t1.y; ++y) {
+        tile_loader_->load(Tile(x, y), grid_);
+      }
+    }
+  }
+
+  /**
+   * Nearest traversable vertex to the start position, or the start cell if
+   * none is traversable. The grid is not modified.
+   * @return The vertex, INVALID_VERTEX if the start cell is not known either.
+   */
+  VertexId startVertex(const Graph &graph, const Vec3 &p0) const {
+    const auto start = grid_.findPoint({p0.x(), p0.y()});
+    VertexId v0 = start ? VertexId(*start) : INVALID_VERTEX;
+    if (!start) {
+      RCLCPP_WARN(nh_->get_logger(), "Robot position %s is not in the map.",
+                  format(p0).c_str());
+    } else if (!graph.costsInBounds(grid_.currentCosts(*start))) {
+      RCLCPP_WARN(nh_->get_logger(), "Robot position %s is not traversable.",
+                  format(p0).c_str());
+    }
+
+    // Use the nearest traversable point to robot as the starting point.
+    float best_dist = std::numeric_limits<float>::infinity();
+    for (VertexId v = 0; v < grid_.size(); ++v) {
+      if (!graph.costsInBounds(grid_.currentCosts(v))) {
+        continue;
+      }
+
+      Value dist = (toVec3(grid_.point(v)) - p0).norm();
+      if (dist < best_dist) {
+        v0 = v;
+        best_dist = dist;
+      }
+    }
+    if (v0 == INVALID_VERTEX) {
+      return v0;
+    }
+    RCLCPP_INFO(nh_->get_logger(),
+                "Closest traversable point to start: %s (%.3f).",
+                format(toVec3(grid_.point(v0))).c_str(), best_dist);
+    return v0;
+  }
+
+  template <typename Vertices>
+  void watchPath(const Graph &graph, const Vertices &path, const Cell &goal,
+                 float tolerance) {
+    if (path_check_margin_ < 0.f) {
+      return;
+    }
+    const int margin = int(std::ceil(path_check_margin_ / grid_.cellSize()));
+    path_monitor_.reset(graph, grid_, path, margin, goal, tolerance);
+  }
+
+  /**
+   * Handle goal regions outside the start component, known to be
+   * unreachable without searching. The goal is redirected to the nearest
+   * cell of the start component, if enabled, or rejected.
+   * @return False if the goal is rejected.
+   */
+  bool redirectGoal(VertexId v0, const Vec3 &p1,
+                    std::pmr::vector<VertexId> &goal_region) {
+    // Ad-hoc costs are not tracked by the components.
+    if (!adhoc_costs_.empty() || !components_.traversable(v0)) {
+      return true;
+    }
+    for (const auto &v : goal_region) {
+      if (components_.connected(v0, v)) {
+        return true;
+      }
+    }
+    if (!redirect_goals_) {
+      RCLCPP_WARN(nh_->get_logger(),
+                  "Goal %s not connected to start, rejected.",
+                  format(p1).c_str());
+      return false;
+    }
+    VertexId goal = v0;
+    float best_dist = std::numeric_limits<float>::infinity();
+    for (VertexId v = 0; v < grid_.size(); ++v) {
+      if (!components_.connected(v0, v)) {
+        continue;
+      }
+      const float dist = (toVec3(grid_.point(v)) - p1).norm();
+      if (dist < best_dist) {
+        goal = v;
+        best_dist = dist;
+      }
+    }
+    goal_region = {goal};
+    RCLCPP_INFO(nh_->get_logger(),
+                "Goal %s not connected to start, redirected to %s.",
+                format(p1).c_str(), format(toVec3(grid_.point(goal))).c_str());
+    return true;
+  }
+
   bool plan(nav_msgs::srv::GetPlan::Request::SharedPtr req,
             nav_msgs::srv::GetPlan::Response::SharedPtr res) {
     Timer t;
@@ -296,22 +832,15 @@ public:
                 format(req->start.pose.position).c_str(),
                 format(req->goal.pose.position).c_str(), req->tolerance);
     last_request_ = req;
+    updateGridTime();
 
     if (grid_.empty()) {
       RCLCPP_WARN(nh_->get_logger(), "Cannot plan in empty grid.");
       return false;
     }
 
-    geometry_msgs::msg::PoseStamped start = req->start;
-    if (!isValid(start.pose.position)) {
-      const auto tf =
-          tf_->lookupTransform(map_frame_, robot_frame_, rclcpp::Time(0),
-                               rclcpp::Duration::from_seconds(tf_timeout_));
-      transform_to_pose(tf, start);
-    }
-
+    const geometry_msgs::msg::PoseStamped start = startPose(req->start);
     if (mode_ == 2) {
-      start.pose.position.z = 0.f;
       req->goal.pose.position.z = 0.f;
     }
 
@@ -327,29 +856,85 @@ public:
       }
     }
 
-    Graph graph(grid_, neighborhood_, max_costs_);
-    VertexId v0 = grid_.cellId(grid_.pointToCell({p0.x(), p0.y()}));
-    if (!graph.costsInBounds(v0)) {
-      RCLCPP_WARN(nh_->get_logger(), "Robot position %s is not traversable.",
-                  format(toVec3(grid_.point(v0))).c_str());
+    if (tile_loader_) {
+      const size_t n = tile_loader_->applyPrefetched(grid_);
+      RCLCPP_DEBUG(nh_->get_logger(), "%lu prefetched tiles loaded.", n);
     }
 
-    // Use the nearest traversable point to robot as the starting point.
-    float best_dist = std::numeric_limits<float>::infinity();
-    for (VertexId v = 0; v < grid_.size(); ++v) {
-      if (!graph.costsInBounds(grid_.costs(v))) {
-        continue;
+    // Only cells changed since the last plan can change the frontier or
+    // invalidate the last path.
+    Graph graph(grid_, neighborhood_, max_costs_);
+    t_part.reset();
+    grid_.takeChangedCells(changed_cells_);
+    frontier_.update(graph, grid_, changed_cells_);
+    path_monitor_.update(grid_, changed_cells_);
+    components_.update(graph, grid_, changed_cells_);
+    RCLCPP_DEBUG(nh_->get_logger(),
+                 "Frontier and components updated from %lu changed cells: "
+                 "%lu frontier cells, %lu clusters (%.6f s).",
+                 changed_cells_.size(), frontier_.size(),
+                 frontier_.numClusters(), t_part.seconds_elapsed());
+    t_part.reset();
+
+    // Reuse the last path, trimmed to the robot, if nothing along it changed.
+    const Cell goal_cell = grid_.pointToCell({p1.x(), p1.y()});
+    if (path_check_margin_ >= 0.f && isValid(req->goal.pose.position) &&
+        adhoc_costs_.empty() &&
+        path_monitor_.sameGoal(goal_cell, req->tolerance)) {
+      const auto path_vertices = path_monitor_.remaining(
+          graph, grid_, {p0.x(), p0.y()},
+          std::max(path_check_margin_, grid_.cellSize()), path_cost_tolerance_);
+      if (!path_vertices.empty()) {
+        res->plan.header.frame_id = map_frame_;
+        res->plan.header.stamp = nh_->get_clock()->now();
+        res->plan.poses.push_back(start);
+        appendPath(path_vertices, grid_, res->plan);
+        last_plan_ = res->plan;
+        RCLCPP_INFO(nh_->get_logger(),
+                    "Last path still valid, %lu poses toward goal %s "
+                    "(%.6f s).",
+                    res->plan.poses.size(), format(p1).c_str(),
+                    t.seconds_elapsed());
+        return true;
       }
+      path_monitor_.clear();
+    }
 
-      Value dist = (toVec3(grid_.point(v)) - p0).norm();
-      if (dist < best_dist) {
-        v0 = v;
-        best_dist = dist;
+    // Reuse the plan from the same start cell to the same goal cell if the
+    // grid has not changed since, unless ad-hoc costs change with every plan.
+    std::optional<PlanKey> plan_key;
+    if (isValid(req->goal.pose.position) && adhoc_costs_.empty()) {
+      size_t params = searchParamsHash(neighborhood_, max_costs_);
+      hash_combine(params, req->tolerance);
+      plan_key =
+          PlanKey{grid_.pointToCell({p0.x(), p0.y()}), goal_cell, params};
+      const auto *cached = plan_cache_.find(grid_, *plan_key);
+      if (cached) {
+        res->plan.header.frame_id = map_frame_;
+        res->plan.header.stamp = nh_->get_clock()->now();
+        res->plan.poses.push_back(start);
+        appendPath(cached->path, grid_, res->plan);
+        last_plan_ = res->plan;
+        RCLCPP_INFO(nh_->get_logger(),
+                    "Cached path with %lu poses toward goal %s (hit rate "
+                    "%.2f, %lu hits, %lu misses, %.6f s).",
+                    res->plan.poses.size(), format(p1).c_str(),
+                    plan_cache_.hitRate(), plan_cache_.hits(),
+                    plan_cache_.misses(), t.seconds_elapsed());
+        return true;
       }
     }
-    RCLCPP_INFO(nh_->get_logger(),
-                "Closest traversable point to start: %s (%.3f).",
-                format(toVec3(grid_.point(v0))).c_str(), best_dist);
+
+    loadTiles(p0);
+    if (isValid(req->goal.pose.position)) {
+      loadTiles(p1, req->tolerance);
+    }
+    const VertexId v0 = startVertex(graph, p0);
+    if (v0 == INVALID_VERTEX) {
+      RCLCPP_ERROR(nh_->get_logger(), "No start for planning from %s.",
+                   format(p0).c_str());
+      return false;
+    }
 
     // Apply ad-hoc costs if enabled
     if (!adhoc_costs_.empty()) {
@@ -367,16 +952,61 @@ public:
                    format(p0).c_str(), robot_yaw, t_adhoc.seconds_elapsed());
     }
 
-    // ShortestPaths sp(grid_, v0, v1, neighborhood_, max_costs_);
-    std::optional<VertexId> v1 = std::nullopt;
+    // Serve paths to frequently requested goals from cost-to-go fields,
+    // unless ad-hoc costs change with every plan.
+    if (plan_to_goal_ && isValid(req->goal.pose.position) &&
+        adhoc_costs_.empty()) {
+      const Cell goal = grid_.pointToCell({float(p1.x()), float(p1.y())});
+      auto field = cost_to_go_.find(grid_, goal);
+      if (!field && cost_to_go_min_requests_ > 0 &&
+          cost_to_go_.countRequest(goal) >=
+              size_t(cost_to_go_min_requests_)) {
+        field = cost_to_go_.get(grid_, goal, neighborhood_, max_costs_);
+      }
+      const auto path_vertices =
+          field ? descendCostToGo(graph, *field, v0) : std::vector<VertexId>();
+      if (!path_vertices.empty()) {
+        plan_cache_.insert(grid_, *plan_key, path_vertices);
+        watchPath(graph, path_vertices, goal_cell, req->tolerance);
+        res->plan.header.frame_id = map_frame_;
+        res->plan.header.stamp = nh_->get_clock()->now();
+        res->plan.poses.push_back(start);
+        appendPath(path_vertices, grid_, res->plan);
+        last_plan_ = res->plan;
+        RCLCPP_INFO(nh_->get_logger(),
+                    "Path with %lu poses toward goal %s served from "
+                    "cost-to-go field (%.3f s).",
+                    res->plan.poses.size(), format(p1).c_str(),
+                    t.seconds_elapsed());
+        return true;
+      }
+    }
+
+    // The search stops at any cell of the goal region. Scratch vectors live
+    // in the plan arena, released after the plan.
+    std::pmr::vector<VertexId> goal_region(plan_arena_.resource());
     if (plan_to_goal_ && isValid(req->goal.pose.position)) {
       p1.z() = 0.f;
-      v1 = grid_.cellId(grid_.pointToCell({p1.x(), p1.y()}));
+      goalRegion(grid_, {p1.x(), p1.y()}, req->tolerance, goal_region);
+      if (!redirectGoal(v0, p1, goal_region)) {
+        return false;
+      }
     }
-    ShortestPaths sp(grid_, v0, v1, neighborhood_, max_costs_);
+    // Search again in place unless the last search is still shared.
+    if (last_search_ && last_search_.use_count() == 1) {
+      last_search_->search(grid_, v0, goal_region, neighborhood_, max_costs_,
+                           GoalMode::ANY);
+    } else {
+      last_search_ = std::make_shared<ShortestPaths>(
+          grid_, v0, goal_region, neighborhood_, max_costs_, GoalMode::ANY);
+    }
+    const ShortestPaths &sp = *last_search_;
     RCLCPP_INFO(nh_->get_logger(), "Dijkstra (%lu pts): %.3f s.", grid_.size(),
                 t_part.seconds_elapsed());
     createAndPublishMapCloud(sp);
+    if (tile_loader_) {
+      prefetchStaticTiles(start.pose, sp);
+    }
 
     // If planning for a given goal, return path to the closest reachable
     // point from the goal.
@@ -385,18 +1015,21 @@ public:
       Vec3 p1 = toVec3(req->goal.pose.position);
       p1.z() = 0.f;
 
-      VertexId v1 = INVALID_VERTEX;
-      Value best_dist = std::numeric_limits<Cost>::infinity();
-      // TODO: Use graph vertex iterator.
-      for (VertexId v = 0; v < grid_.size(); ++v) {
-        if (!std::isfinite(sp.pathCost(v))) {
-          continue;
-        }
-
-        Value dist = (toVec3(grid_.point(v)) - p1).norm();
-        if (dist < best_dist) {
-          v1 = v;
-          best_dist = dist;
+      // Without a reached goal region, use the closest reachable point.
+      VertexId v1 = sp.reachedGoal();
+      if (v1 == INVALID_VERTEX) {
+        Value best_dist = std::numeric_limits<Cost>::infinity();
+        // TODO: Use graph vertex iterator.
+        for (VertexId v = 0; v < grid_.size(); ++v) {
+          if (!std::isfinite(sp.pathCost(v))) {
+            continue;
+          }
+
+          Value dist = (toVec3(grid_.point(v)) - p1).norm();
+          if (dist < best_dist) {
+            v1 = v;
+            best_dist = dist;
+          }
         }
       }
       if (v1 == INVALID_VERTEX) {
@@ -406,63 +1039,109 @@ public:
                      t.seconds_elapsed());
         return false;
       }
-      auto path_vertices = tracePathVertices(v0, v1, sp.predecessors());
+      std::pmr::vector<VertexId> path_vertices(plan_arena_.resource());
+      tracePathVertices(v0, v1, sp.predecessors(), path_vertices);
+      if (plan_key) {
+        plan_cache_.insert(grid_, *plan_key, path_vertices);
+        watchPath(graph, path_vertices, goal_cell, req->tolerance);
+      }
       res->plan.header.frame_id = map_frame_;
       res->plan.header.stamp = nh_->get_clock()->now();
       res->plan.poses.push_back(start);
       appendPath(path_vertices, grid_, res->plan);
+      last_plan_ = res->plan;
       RCLCPP_INFO(nh_->get_logger(),
-                  "Path with %lu poses toward goal %s planned (%.3f s).",
+                  "Path with %lu poses toward goal %s planned (plan cache "
+                  "hit rate %.2f, %.3f s).",
                   res->plan.poses.size(), format(p1).c_str(),
-                  t.seconds_elapsed());
+                  plan_cache_.hitRate(), t.seconds_elapsed());
       return true;
     }
-    RCLCPP_WARN(nh_->get_logger(), "Goal not valid.");
+    RCLCPP_INFO(nh_->get_logger(), "Goal not valid, exploring.");
 
-    // TODO: Return random path in exploration mode.
-    return false;
+    // Explore toward the frontier cell with the best ranked cluster.
+    const VertexId frontier = frontier_.best(
+        sp.pathCosts(), frontier_utility_weight_, size_t(min_frontier_size_));
+    if (frontier == INVALID_VERTEX) {
+      RCLCPP_WARN(nh_->get_logger(),
+                  "No reachable frontier among %lu clusters (%.3f s).",
+                  frontier_.numClusters(), t.seconds_elapsed());
+      return false;
+    }
+    res->plan.header.frame_id = map_frame_;
+    res->plan.header.stamp = nh_->get_clock()->now();
+    res->plan.poses.push_back(start);
+    std::pmr::vector<VertexId> path_vertices(plan_arena_.resource());
+    tracePathVertices(v0, frontier, sp.predecessors(), path_vertices);
+    appendPath(path_vertices, grid_, res->plan);
+    last_plan_ = res->plan;
+    RCLCPP_INFO(nh_->get_logger(),
+                "Path with %lu poses toward frontier %s (%.1f m) planned "
+                "(%.3f s).",
+                res->plan.poses.size(),
+                format(toVec3(grid_.point(frontier))).c_str(),
+                frontier_.utility(frontier), t.seconds_elapsed());
+    return true;
   }
 
+  /** Fill the cloud with map cells, fields are added to an empty cloud. */
   void fillMapCloud(sensor_msgs::msg::PointCloud2 &cloud, const Grid &grid,
                     const std::vector<Cost> &path_costs) {
     // TODO: Allow sending local map.
-    append_field<float>("x", 1, cloud);
-    append_field<float>("y", 1, cloud);
-    append_field<float>("z", 1, cloud);
-    append_field<float>("cost", 1, cloud);
-    append_field<float>("path_cost", 1, cloud);
+    if (cloud.fields.empty()) {
+      append_field<float>("x", 1, cloud);
+      append_field<float>("y", 1, cloud);
+      append_field<float>("z", 1, cloud);
+      append_field<float>("cost", 1, cloud);
+      append_planning_fields(cloud);
+    }
     resize_cloud(cloud, 1, grid_.size());
 
     sensor_msgs::PointCloud2Iterator<float> x_it(cloud, "x");
     sensor_msgs::PointCloud2Iterator<float> cost_it(cloud, "cost");
     sensor_msgs::PointCloud2Iterator<float> path_cost_it(cloud, "path_cost");
-    for (VertexId v = 0; v < grid_.size();
-         ++v, ++x_it, ++cost_it, ++path_cost_it) {
+    sensor_msgs::PointCloud2Iterator<float> utility_it(cloud, "utility");
+    sensor_msgs::PointCloud2Iterator<float> final_cost_it(cloud, "final_cost");
+    for (VertexId v = 0; v < grid_.size(); ++v, ++x_it, ++cost_it,
+                  ++path_cost_it, ++utility_it, ++final_cost_it) {
       const auto p = grid_.point(v);
       x_it[0] = p.x;
       x_it[1] = p.y;
       x_it[2] = 0.f;
-      cost_it[0] = grid_.costs(v).total();
+      cost_it[0] = grid_.currentCosts(v).total();
       path_cost_it[0] = path_costs[v];
+      utility_it[0] = frontier_.utility(v);
+      final_cost_it[0] =
+          path_costs[v] - frontier_utility_weight_ * utility_it[0];
     }
   }
 
+  /** Publish the map cloud, reusing its buffer across plans. */
   void createAndPublishMapCloud(const ShortestPaths &sp) {
-    sensor_msgs::msg::PointCloud2 cloud;
-    cloud.header.frame_id = map_frame_;
-    cloud.header.stamp = nh_->get_clock()->now();
-    fillMapCloud(cloud, grid_, sp.pathCosts());
-    map_pub_->publish(cloud);
+    map_cloud_.header.frame_id = map_frame_;
+    map_cloud_.header.stamp = nh_->get_clock()->now();
+    fillMapCloud(map_cloud_, grid_, sp.pathCosts());
+    map_pub_->publish(map_cloud_);
   }
 
+  /** Plan, catching transform errors, and release the plan arena. */
   bool planSafe(nav_msgs::srv::GetPlan::Request::SharedPtr req,
                 nav_msgs::srv::GetPlan::Response::SharedPtr res) {
+#ifdef GRID_PLANNER_COUNT_ALLOCATIONS
+    const size_t allocations = allocationCount();
+#endif
+    bool planned = false;
     try {
-      return plan(req, res);
+      planned = plan(req, res);
     } catch (const tf2::TransformException &ex) {
       RCLCPP_ERROR(nh_->get_logger(), "Transform failed: %s.", ex.what());
-      return false;
     }
+    plan_arena_.release();
+#ifdef GRID_PLANNER_COUNT_ALLOCATIONS
+    RCLCPP_INFO(nh_->get_logger(), "Heap allocations during planning: %lu.",
+                allocationCount() - allocations);
+#endif
+    return planned;
   }
 
   bool requestPlan(nav_msgs::srv::GetPlan::Request::SharedPtr req,
@@ -474,19 +1153,586 @@ public:
     return planSafe(req, res);
   }
 
+  /**
+   * Plan for all robots with a valid goal.
+   *
+   * Tiles of starts and goals are loaded first, as these may add cells,
+   * which are then looked up without modifying the grid. Searches run in
+   * parallel over the same grid, which is not modified until all of them
+   * finish, each with its own search workspace.
+   */
+  void planRobots() {
+    Timer t;
+    if (grid_.empty()) {
+      return;
+    }
+    if (tile_loader_) {
+      tile_loader_->applyPrefetched(grid_);
+    }
+    Graph graph(grid_, neighborhood_, max_costs_);
+    std::vector<size_t> active;
+    std::vector<geometry_msgs::msg::PoseStamped> starts;
+    std::vector<VertexId> start_vertices;
+    std::vector<VertexId> goal_vertices;
+    for (size_t i = 0; i < robots_.size(); ++i) {
+      auto &robot = robots_[i];
+      if (!robot.request || !isValid(robot.request->goal.pose.position)) {
+        continue;
+      }
+      const auto &p1 = robot.request->goal.pose.position;
+      loadTiles(toVec3(p1));
+      const auto goal = grid_.findPoint({float(p1.x), float(p1.y)});
+      if (!goal) {
+        RCLCPP_WARN(nh_->get_logger(), "Goal %s of robot %s not in grid.",
+                    format(p1).c_str(), robot.frame.c_str());
+        continue;
+      }
+      try {
+        starts.push_back(startPose(robot.request->start, robot.frame));
+      } catch (const tf2::TransformException &ex) {
+        RCLCPP_ERROR(nh_->get_logger(), "Transform of robot %s failed: %s.",
+                     robot.frame.c_str(), ex.what());
+        continue;
+      }
+      loadTiles(toVec3(starts.back().pose.position));
+      const VertexId v0 =
+          startVertex(graph, toVec3(starts.back().pose.position));
+      if (v0 == INVALID_VERTEX) {
+        starts.pop_back();
+        continue;
+      }
+      start_vertices.push_back(v0);
+      goal_vertices.push_back(*goal);
+      active.push_back(i);
+    }
+
+    const Grid &grid = grid_;
+    const auto stamp = nh_->get_clock()->now();
+#pragma omp parallel for schedule(dynamic, 1)
+    for (size_t k = 0; k < active.size(); ++k) {
+      auto &robot = robots_[active[k]];
+      if (robot.search && robot.search.use_count() == 1) {
+        robot.search->search(grid, start_vertices[k], goal_vertices[k],
+                             neighborhood_, max_costs_);
+      } else {
+        robot.search = std::make_shared<ShortestPaths>(
+            grid, start_vertices[k], goal_vertices[k], neighborhood_,
+            max_costs_);
+      }
+      robot.plan = nav_msgs::msg::Path();
+      robot.plan.header.frame_id = map_frame_;
+      robot.plan.header.stamp = stamp;
+      if (std::isfinite(robot.search->pathCost(goal_vertices[k]))) {
+        robot.plan.poses.push_back(starts[k]);
+        appendPath(tracePathVertices(start_vertices[k], goal_vertices[k],
+                                     robot.search->predecessors()),
+                   grid, robot.plan);
+      }
+    }
+
+    for (const auto &i : active) {
+      robots_[i].path_pub->publish(robots_[i].plan);
+    }
+    RCLCPP_INFO(nh_->get_logger(),
+                "Paths of %lu robots planned in parallel (%.3f s).",
+                active.size(), t.seconds_elapsed());
+  }
+
+  void requestRobotPlan(size_t i,
+                        nav_msgs::srv::GetPlan::Request::SharedPtr req,
+                        nav_msgs::srv::GetPlan::Response::SharedPtr res) {
+    RCLCPP_INFO(nh_->get_logger(), "Planning request for robot %s received.",
+                robots_[i].frame.c_str());
+    robots_[i].request = req;
+    planRobots();
+    res->plan = robots_[i].plan;
+  }
+
+  /**
+   * Plan paths to multiple goals with a single search from the start,
+   * stopped once all goals are settled. Goals outside the grid are not
+   * searched for. Ad-hoc costs are not applied.
+   */
+  void requestPlans(grid_planner::srv::GetPlans::Request::SharedPtr req,
+                    grid_planner::srv::GetPlans::Response::SharedPtr res) {
+    Timer t;
+    res->plans.resize(req->goals.size());
+    res->costs.resize(req->goals.size(),
+                      std::numeric_limits<float>::infinity());
+    for (auto &path : res->plans) {
+      path.header.frame_id = map_frame_;
+      path.header.stamp = nh_->get_clock()->now();
+    }
+    if (grid_.empty() || req->goals.empty()) {
+      return;
+    }
+    geometry_msgs::msg::PoseStamped start;
+    try {
+      start = startPose(req->start);
+    } catch (const tf2::TransformException &ex) {
+      RCLCPP_ERROR(nh_->get_logger(), "Transform failed: %s.", ex.what());
+      return;
+    }
+    if (tile_loader_) {
+      tile_loader_->applyPrefetched(grid_);
+    }
+
+    Graph graph(grid_, neighborhood_, max_costs_);
+    loadTiles(toVec3(start.pose.position));
+    for (const auto &goal : req->goals) {
+      if (isValid(goal.pose.position)) {
+        loadTiles(toVec3(goal.pose.position));
+      }
+    }
+    const VertexId v0 = startVertex(graph, toVec3(start.pose.position));
+    if (v0 == INVALID_VERTEX) {
+      return;
+    }
+    std::vector<VertexId> goals(req->goals.size(), INVALID_VERTEX);
+    std::vector<VertexId> search_goals;
+    search_goals.reserve(goals.size());
+    for (size_t i = 0; i < goals.size(); ++i) {
+      const auto &p = req->goals[i].pose.position;
+      const auto v = grid_.findPoint({float(p.x), float(p.y)});
+      if (isValid(p) && v) {
+        goals[i] = *v;
+        search_goals.push_back(goals[i]);
+      }
+    }
+    if (search_goals.empty()) {
+      RCLCPP_WARN(nh_->get_logger(), "No goal within the grid.");
+      return;
+    }
+
+    const ShortestPaths sp(grid_, v0, search_goals, neighborhood_, max_costs_);
+    size_t n = 0;
+    for (size_t i = 0; i < goals.size(); ++i) {
+      if (goals[i] == INVALID_VERTEX || !std::isfinite(sp.pathCost(goals[i]))) {
+        continue;
+      }
+      res->plans[i].poses.push_back(start);
+      appendPath(tracePathVertices(v0, goals[i], sp.predecessors()), grid_,
+                 res->plans[i]);
+      res->costs[i] = sp.pathCost(goals[i]);
+      ++n;
+    }
+    RCLCPP_INFO(nh_->get_logger(),
+                "Paths to %lu of %lu goals planned with one search (%.3f s).",
+                n, goals.size(), t.seconds_elapsed());
+  }
+
+  /**
+   * Plan diverse alternative paths, sharing one search from the start and
+   * the cached cost-to-go field toward the goal among all of them.
+   */
+  void requestAlternativePlans(
+      grid_planner::srv::GetAlternativePlans::Request::SharedPtr req,
+      grid_planner::srv::GetAlternativePlans::Response::SharedPtr res) {
+    Timer t;
+    const auto &p1 = req->goal.pose.position;
+    if (grid_.empty() || !isValid(p1) || req->num_paths == 0) {
+      return;
+    }
+    geometry_msgs::msg::PoseStamped start;
+    try {
+      start = startPose(req->start);
+    } catch (const tf2::TransformException &ex) {
+      RCLCPP_ERROR(nh_->get_logger(), "Transform failed: %s.", ex.what());
+      return;
+    }
+    if (tile_loader_) {
+      tile_loader_->applyPrefetched(grid_);
+    }
+    Graph graph(grid_, neighborhood_, max_costs_);
+    loadTiles(toVec3(start.pose.position));
+    loadTiles(toVec3(p1));
+    const VertexId v0 = startVertex(graph, toVec3(start.pose.position));
+    if (v0 == INVALID_VERTEX) {
+      return;
+    }
+    const auto field = cost_to_go_.get(
+        grid_, grid_.pointToCell({float(p1.x), float(p1.y)}), neighborhood_,
+        max_costs_);
+    if (!field) {
+      RCLCPP_WARN(nh_->get_logger(), "Goal %s not in grid.",
+                  format(p1).c_str());
+      return;
+    }
+    const ShortestPaths sp(grid_, v0, std::nullopt, neighborhood_,
+                           max_costs_);
+    const auto paths =
+        alternativePaths(graph, sp, v0, *field, req->num_paths,
+                         alternative_max_stretch_, alternative_max_overlap_);
+    res->plans.resize(paths.size());
+    for (size_t i = 0; i < paths.size(); ++i) {
+      res->plans[i].header.frame_id = map_frame_;
+      res->plans[i].header.stamp = nh_->get_clock()->now();
+      res->plans[i].poses.push_back(start);
+      appendPath(paths[i].path, grid_, res->plans[i]);
+      res->costs.push_back(paths[i].cost);
+    }
+    RCLCPP_INFO(nh_->get_logger(),
+                "%lu of %u alternative paths toward %s planned (%.3f s).",
+                paths.size(), req->num_paths, format(p1).c_str(),
+                t.seconds_elapsed());
+  }
+
+  /** Query costs at points and along polylines directly from the grid. */
+  void queryCosts(grid_planner::srv::QueryCosts::Request::SharedPtr req,
+                  grid_planner::srv::QueryCosts::Response::SharedPtr res) {
+    Timer t;
+    const size_t n = req->x.size();
+    if (req->y.size() != n) {
+      res->message = "Point coordinates x and y differ in size.";
+      return;
+    }
+    const auto &starts = req->polyline_starts;
+    for (size_t i = 0; i < starts.size(); ++i) {
+      if (starts[i] >= n || (i > 0 && starts[i] <= starts[i - 1])) {
+        res->message = "Invalid polyline starts.";
+        return;
+      }
+    }
+    updateGridTime();
+    const Grid &grid = grid_;
+    const Graph graph(grid, neighborhood_, max_costs_);
+    std::vector<Cell> cells(n);
+    for (size_t i = 0; i < n; ++i) {
+      cells[i] = grid.pointToCell({req->x[i], req->y[i]});
+    }
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+    res->layer_costs.resize(4 * n, nan);
+    res->total_costs.resize(n, nan);
+    res->traversable.resize(n, false);
+    for (size_t i = 0; i < n; ++i) {
+      if (!grid.hasCell(cells[i])) {
+        continue;
+      }
+      const Costs costs = grid.currentCosts(grid.cellId(cells[i]));
+      std::copy(costs.data, costs.data + 4, &res->layer_costs[4 * i]);
+      res->total_costs[i] = costs.total();
+      res->traversable[i] = graph.costsInBounds(costs);
+    }
+
+    res->line_integrals.resize(starts.size(), 0.f);
+    for (size_t k = 0; k < starts.size(); ++k) {
+      const size_t end = k + 1 < starts.size() ? starts[k + 1] : n;
+      for (size_t i = starts[k] + 1; i < end; ++i) {
+        res->line_integrals[k] += grid.lineIntegral(
+            {req->x[i - 1], req->y[i - 1]}, {req->x[i], req->y[i]});
+      }
+    }
+    res->success = true;
+    RCLCPP_DEBUG(nh_->get_logger(),
+                 "Costs queried at %lu points, %lu polylines (%.6f s).", n,
+                 starts.size(), t.seconds_elapsed());
+  }
+
+  /**
+   * Query interpolated cost-to-go and its gradient at points. The field is
+   * computed on first query toward a goal and cached until it is outdated.
+   */
+  void queryCostToGo(
+      grid_planner::srv::QueryCostToGo::Request::SharedPtr req,
+      grid_planner::srv::QueryCostToGo::Response::SharedPtr res) {
+    Timer t;
+    if (req->x.size() != req->y.size()) {
+      res->message = "Point coordinates x and y differ in size.";
+      return;
+    }
+    const auto &goal =
+        isValid(req->goal) ? req->goal : last_request_->goal.pose.position;
+    if (!isValid(goal) || grid_.empty()) {
+      res->message = "No valid goal.";
+      return;
+    }
+    loadTiles(toVec3(goal));
+    const Grid &grid = grid_;
+    const auto field = cost_to_go_.get(
+        grid, grid.pointToCell({float(goal.x), float(goal.y)}), neighborhood_,
+        max_costs_);
+    if (!field) {
+      res->message = "Goal not in grid.";
+      return;
+    }
+    const size_t n = req->x.size();
+    res->costs.resize(n);
+    res->gradient_x.resize(n);
+    res->gradient_y.resize(n);
+    for (size_t i = 0; i < n; ++i) {
+      res->costs[i] = field->interpolate(grid, {req->x[i], req->y[i]},
+                                         res->gradient_x[i],
+                                         res->gradient_y[i]);
+    }
+    res->success = true;
+    RCLCPP_DEBUG(nh_->get_logger(),
+                 "Cost-to-go toward %s queried at %lu points (%.6f s).",
+                 format(goal).c_str(), n, t.seconds_elapsed());
+  }
+
+  /**
+   * Export path costs of the last plan, or cost-to-go toward the last goal,
+   * as a raster streamed in strips of tile height.
+   */
+  void exportCostField(
+      grid_planner::srv::ExportCostField::Request::SharedPtr req,
+      grid_planner::srv::ExportCostField::Response::SharedPtr res) {
+    Timer t;
+    const Grid &grid = grid_;
+    const std::vector<Cost> *field = nullptr;
+    CostToGoCache::FieldPtr cost_to_go;
+    if (req->field == "path_cost") {
+      if (last_search_) {
+        field = &last_search_->pathCosts();
+      }
+    } else if (req->field == "cost_to_go") {
+      const auto &p = last_request_->goal.pose.position;
+      if (isValid(p)) {
+        cost_to_go = cost_to_go_.get(
+            grid, grid.pointToCell({float(p.x), float(p.y)}), neighborhood_,
+            max_costs_);
+      }
+      if (cost_to_go) {
+        field = &cost_to_go->costs;
+      }
+    } else {
+      res->message = "Unknown field " + req->field + ".";
+      return;
+    }
+    if (!field || grid.empty()) {
+      res->message = "Field " + req->field + " not available.";
+      return;
+    }
+
+    Cell c0, c1;
+    if (req->min_x <= req->max_x && req->min_y <= req->max_y) {
+      c0 = grid.pointToCell({req->min_x, req->min_y});
+      c1 = grid.pointToCell({req->max_x, req->max_y});
+    } else {
+      c0 = c1 = grid.cell(0);
+      for (VertexId v = 1; v < grid.size(); ++v) {
+        const Cell &c = grid.cell(v);
+        c0 = Cell(std::min(c0.x, c.x), std::min(c0.y, c.y));
+        c1 = Cell(std::max(c1.x, c.x), std::max(c1.y, c.y));
+      }
+    }
+    res->width = uint32_t(c1.x - c0.x + 1);
+    res->height = uint32_t(c1.y - c0.y + 1);
+    const float cell_size = grid.cellSize();
+    RasterWriter writer(req->path, res->width, res->height,
+                        {req->field, "total_cost"}, c0.x * cell_size,
+                        (c1.y + 1) * cell_size, cell_size);
+    if (!writer.good()) {
+      res->message = "Could not open " + req->path + ".";
+      return;
+    }
+
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+    std::vector<float> lines(TILE_SIZE * writer.lineSize());
+    for (int top = c1.y; top >= c0.y; top -= TILE_SIZE) {
+      const int num_lines = std::min(TILE_SIZE, top - c0.y + 1);
+      std::fill(lines.begin(), lines.end(), nan);
+      for (int r = 0; r < num_lines; ++r) {
+        float *line = &lines[r * writer.lineSize()];
+        for (uint32_t x = 0; x < res->width; ++x) {
+          const Cell c(c0.x + int(x), top - r);
+          if (!grid.hasCell(c)) {
+            continue;
+          }
+          const VertexId v = grid.cellId(c);
+          const Cost total = grid.currentCosts(v).total();
+          line[x] = v < field->size() ? (*field)[v] : nan;
+          line[res->width + x] = total;
+          ++res->num_cells;
+          res->total_cost += total;
+        }
+      }
+      writer.writeLines(lines, num_lines);
+    }
+    res->success = writer.close();
+    if (!res->success) {
+      res->message = "Could not write " + req->path + ".";
+      return;
+    }
+    RCLCPP_INFO(nh_->get_logger(),
+                "Field %s exported to %s (%u x %u, %u cells, %.3f s).",
+                req->field.c_str(), req->path.c_str(), res->width,
+                res->height, res->num_cells, t.seconds_elapsed());
+  }
+
   void clearMap(nav2_msgs::srv::ClearEntireCostmap::Request::SharedPtr req,
                 nav2_msgs::srv::ClearEntireCostmap::Response::SharedPtr res) {
     grid_.clear();
+    if (tile_loader_) {
+      tile_loader_->reset();
+    }
+    cost_to_go_.clear();
+    plan_cache_.clear();
+    path_monitor_.clear();
+    frontier_.clear();
+    components_.clear();
+    dynamic_expiry_.clear();
+    // Logged updates must not resurrect the cleared map.
+    saveSnapshot();
     RCLCPP_WARN(nh_->get_logger(), "Map cleared.");
   }
 
+  /**
+   * Reset layers of cells within a polygon, a box, or the whole map, tile by
+   * tile. Only tiles overlapping the region bounds are visited, and cleared
+   * cells are marked changed, so that caches are invalidated locally.
+   */
+  void clearRegion(grid_planner::srv::ClearRegion::Request::SharedPtr req,
+                   grid_planner::srv::ClearRegion::Response::SharedPtr res) {
+    Timer t;
+    std::vector<Point2f> polygon;
+    if (req->x.size() != req->y.size() ||
+        (!req->x.empty() && req->x.size() < 3)) {
+      res->message = "Invalid polygon.";
+      return;
+    }
+    for (size_t i = 0; i < req->x.size(); ++i) {
+      polygon.emplace_back(req->x[i], req->y[i]);
+    }
+    if (polygon.empty() && req->min_x <= req->max_x &&
+        req->min_y <= req->max_y) {
+      polygon = {{req->min_x, req->min_y},
+                 {req->max_x, req->min_y},
+                 {req->max_x, req->max_y},
+                 {req->min_x, req->max_y}};
+    }
+    const uint8_t layers = req->layers ? req->layers : ALL_LAYERS;
+
+    // Region bounds in tiles, everything without a polygon.
+    Tile t0(std::numeric_limits<int16_t>::min(),
+            std::numeric_limits<int16_t>::min());
+    Tile t1(std::numeric_limits<int16_t>::max(),
+            std::numeric_limits<int16_t>::max());
+    if (!polygon.empty()) {
+      Point2f p0 = polygon[0];
+      Point2f p1 = polygon[0];
+      for (const auto &p : polygon) {
+        p0 = Point2f(std::min(p0.x, p.x), std::min(p0.y, p.y));
+        p1 = Point2f(std::max(p1.x, p.x), std::max(p1.y, p.y));
+      }
+      t0 = cellToTile(grid_.pointToCell(p0));
+      t1 = cellToTile(grid_.pointToCell(p1));
+    }
+    std::vector<Tile> tiles;
+    for (const auto &tile_epoch : grid_.tileEpochs()) {
+      const Tile &tile = tile_epoch.first;
+      if (t0.x <= tile.x && tile.x <= t1.x && t0.y <= tile.y &&
+          tile.y <= t1.y) {
+        tiles.push_back(tile);
+      }
+    }
+
+    updateGridTime();
+    const uint32_t epoch = grid_.advanceEpoch();
+    res->num_cells = 0;
+    std::vector<CellId> removed;
+    for (const auto &tile : tiles) {
+      for (int i = 0; i < TILE_CELLS; ++i) {
+        const Cell c = tileCell(tile, uint8_t(i));
+        if (!polygon.empty() && !inPolygon(polygon, grid_.cellToPoint(c))) {
+          continue;
+        }
+        if (req->remove_cells) {
+          if (grid_.hasCell(c)) {
+            removed.push_back(grid_.cellId(c));
+            ++res->num_cells;
+          }
+          continue;
+        }
+        if (!grid_.resetCell(c, layers)) {
+          continue;
+        }
+        ++res->num_cells;
+        if (dynamic_layer_ >= 0 && (layers & (1 << dynamic_layer_))) {
+          if (const auto id = expiryId(c)) {
+            dynamic_expiry_.cancel(*id);
+          }
+        }
+        if (!update_log_) {
+          continue;
+        }
+        for (int l = 0; l < 4; ++l) {
+          if (layers & persistentLayerMask() & (1 << l)) {
+            log_records_.push_back(updateRecord(
+                c, l, std::numeric_limits<Cost>::quiet_NaN(), epoch));
+          }
+        }
+      }
+    }
+    if (update_log_) {
+      update_log_->append(log_records_);
+    }
+    if (!removed.empty()) {
+      removeCells(removed);
+      // Logged updates must not resurrect the removed cells.
+      saveSnapshot();
+    }
+    res->success = true;
+    RCLCPP_INFO(nh_->get_logger(),
+                "Layers 0x%x of %u cells in %lu tiles cleared (%.3f s).",
+                req->remove_cells ? ALL_LAYERS : layers, res->num_cells,
+                tiles.size(), t.seconds_elapsed());
+  }
+
+  /**
+   * Remove cells and compact cell ids, so that vertex arrays stay
+   * proportional to the live map. Structures holding cell ids are remapped
+   * or rebuilt.
+   */
+  void removeCells(const std::vector<CellId> &ids) {
+    Timer t;
+    const auto remap = grid_.removeCells(ids);
+    // Coarse cells are kept, with their expiry.
+    if (!(dynamic_layer_ >= 0 && dynamic_layer_ < 4 &&
+          grid_.layerShift(dynamic_layer_))) {
+      dynamic_expiry_.remap(remap);
+    }
+    cost_to_go_.clear();
+    plan_cache_.clear();
+    path_monitor_.clear();
+    last_search_.reset();
+    for (auto &robot : robots_) {
+      robot.search.reset();
+    }
+    std::vector<CellId> cells(grid_.size());
+    std::iota(cells.begin(), cells.end(), 0);
+    const Graph graph(grid_, neighborhood_, max_costs_);
+    frontier_.clear();
+    frontier_.update(graph, grid_, cells);
+    components_.clear();
+    components_.update(graph, grid_, cells);
+    RCLCPP_INFO(nh_->get_logger(), "%lu cells removed, %lu kept (%.3f s).",
+                ids.size(), grid_.size(), t.seconds_elapsed());
+  }
+
+  /** Even-odd test of a point within a polygon. */
+  static bool inPolygon(const std::vector<Point2f> &polygon,
+                        const Point2f &p) {
+    bool inside = false;
+    for (size_t i = 0, j = polygon.size() - 1; i < polygon.size(); j = i++) {
+      const Point2f &a = polygon[i];
+      const Point2f &b = polygon[j];
+      if ((a.y > p.y) != (b.y > p.y) &&
+          p.x < a.x + (p.y - a.y) / (b.y - a.y) * (b.x - a.x)) {
+        inside = !inside;
+      }
+    }
+    return inside;
+  }
+
   void clearAdHocLayer() {
     if (adhoc_layer_ < 0 || adhoc_layer_ >= 4) {
       return;
     }
     Cost default_cost = default_costs_[adhoc_layer_];
     for (VertexId v = 0; v < grid_.size(); ++v) {
-      grid_.costs(v)[adhoc_layer_] = default_cost;
+      grid_.stampCosts(v)[adhoc_layer_] = default_cost;
+      grid_.updateTotal(v);
     }
   }
 
@@ -507,7 +1753,8 @@ public:
         float dist = (cell_pos - center).norm();
         
         if (dist <= sidelobes_radius_) {
-          grid_.costs(v)[adhoc_layer_] = sidelobes_cost_;
+          grid_.stampCosts(v)[adhoc_layer_] = sidelobes_cost_;
+          grid_.updateTotal(v);
         }
       }
     }
@@ -570,17 +1817,196 @@ public:
       }
     }
 
-    for (int i = 0; i < input->height * input->width; ++i, ++x_it) {
+    updateGridTime();
+    const uint32_t epoch = grid_.advanceEpoch();
+    if (update_log_) {
+      log_records_.reserve(input->height * input->width * levels.size());
+    }
+    const size_t n = input->height * input->width;
+    cloud_cells_.resize(n);
+    for (size_t k = 0; k < n; ++k, ++x_it) {
       Vec3 p(x_it[0], x_it[1], x_it[2]);
       p = transform * p;
-      for (int j = 0; j < levels.size(); ++j) {
-        if (std::isfinite(cost_iters[j][0])) {
-          grid_.updatePointCost({p.x(), p.y()}, levels[j],
-                                weights[j] * cost_iters[j][0]);
+      cloud_cells_[k] = grid_.pointToCell({p.x(), p.y()});
+    }
+    // Fuse layer by layer so that the fusion policy is resolved per batch.
+    cloud_costs_.resize(n);
+    for (int j = 0; j < levels.size(); ++j) {
+      for (size_t k = 0; k < n; ++k, ++cost_iters[j]) {
+        cloud_costs_[k] = weights[j] * cost_iters[j][0];
+      }
+      grid_.updateCellCosts(cloud_cells_, levels[j], cloud_costs_);
+      if (delta_layer_mask_ & (1 << levels[j])) {
+        queueDeltaTiles(cloud_cells_, cloud_costs_);
+      }
+      if (levels[j] == dynamic_layer_) {
+        const float expiry = grid_.time() + dynamic_ttl_;
+        for (size_t k = 0; k < n; ++k) {
+          if (!std::isfinite(cloud_costs_[k])) {
+            continue;
+          }
+          // Observed cells are stored, scheduling must not create any.
+          if (const auto id = expiryId(cloud_cells_[k])) {
+            dynamic_expiry_.schedule(*id, expiry);
+          }
         }
-        ++cost_iters[j];
       }
+      if (!update_log_ || !(persistentLayerMask() & (1 << levels[j]))) {
+        continue;
+      }
+      for (size_t k = 0; k < n; ++k) {
+        if (std::isfinite(cloud_costs_[k])) {
+          log_records_.push_back(
+              updateRecord(cloud_cells_[k], levels[j], cloud_costs_[k], epoch));
+        }
+      }
+    }
+    if (update_log_) {
+      update_log_->append(log_records_);
+    }
+  }
+
+  /**
+   * Queue tiles of cells with finite observations of a shared layer for the
+   * next delta. Only local observations are queued, so that merged peer
+   * deltas are not sent back.
+   */
+  void queueDeltaTiles(const std::vector<Cell> &cells,
+                       const std::vector<Cost> &costs) {
+    bool first = true;
+    Tile last;
+    for (size_t k = 0; k < cells.size(); ++k) {
+      if (!std::isfinite(costs[k])) {
+        continue;
+      }
+      const Tile tile = cellToTile(cells[k]);
+      if (!first && tile == last) {
+        continue;
+      }
+      first = false;
+      last = tile;
+      if (delta_queued_.insert(tile).second) {
+        delta_queue_.push_back(tile);
+      }
+    }
+  }
+
+  /** Publish tiles of shared layers observed since the last delta. */
+  void publishMapDelta() {
+    Timer t;
+    const uint32_t epoch = grid_.epoch();
+    if (delta_queue_.empty()) {
+      return;
+    }
+
+    grid_planner::msg::MapDelta msg;
+    msg.header.frame_id = map_frame_;
+    msg.header.stamp = nh_->get_clock()->now();
+    msg.source = nh_->get_fully_qualified_name();
+    msg.epoch = epoch;
+    msg.cell_size = grid_.cellSize();
+    std::vector<TileCell> cells;
+    cells.reserve(TILE_CELLS);
+    // Remaining tiles are sent with the next delta.
+    while (!delta_queue_.empty() && msg.num_tiles < max_delta_tiles_) {
+      const Tile tile = delta_queue_.front();
+      delta_queue_.pop_front();
+      delta_queued_.erase(tile);
+      if (encodeGridTile(grid_, tile, delta_layer_mask_, cells, msg.data)) {
+        ++msg.num_tiles;
+      }
+    }
+    if (msg.num_tiles > 0) {
+      map_delta_pub_->publish(msg);
     }
+    RCLCPP_DEBUG(nh_->get_logger(),
+                 "Map delta with %u tiles (%lu B) at epoch %u, %lu tiles "
+                 "queued (%.6f s).",
+                 msg.num_tiles, msg.data.size(), epoch, delta_queue_.size(),
+                 t.seconds_elapsed());
+  }
+
+  /** Queue peer map delta for merging into the peer layer. */
+  void receiveMapDelta(
+      const std::shared_ptr<const grid_planner::msg::MapDelta> &msg) {
+    if (msg->source == nh_->get_fully_qualified_name()) {
+      return;
+    }
+    if (msg->cell_size != grid_.cellSize()) {
+      RCLCPP_WARN(nh_->get_logger(),
+                  "Map delta from %s with cell size %.3f m != %.3f m ignored.",
+                  msg->source.c_str(), msg->cell_size, grid_.cellSize());
+      return;
+    }
+    uint32_t &peer_epoch = peer_epochs_[msg->source];
+    if (msg->epoch < peer_epoch) {
+      RCLCPP_INFO(nh_->get_logger(),
+                  "Stale map delta from %s at epoch %u < %u ignored.",
+                  msg->source.c_str(), msg->epoch, peer_epoch);
+      return;
+    }
+    peer_epoch = msg->epoch;
+    peer_deltas_.push_back({msg});
+    mergePeerDeltas();
+  }
+
+  /**
+   * Merge queued peer deltas into the peer layer, using the total of the
+   * shared layers per cell. At most max_delta_cells cells are merged per
+   * call, the remainder is merged with the next delta or timer tick.
+   */
+  void mergePeerDeltas() {
+    if (peer_deltas_.empty()) {
+      return;
+    }
+    Timer t;
+    const uint32_t epoch = grid_.advanceEpoch();
+    const int max_cells = max_delta_cells_ > 0
+                              ? max_delta_cells_
+                              : std::numeric_limits<int>::max();
+    Tile tile;
+    uint8_t layers;
+    std::vector<TileCell> cells;
+    cells.reserve(TILE_CELLS);
+    int n = 0;
+    while (!peer_deltas_.empty() && n < max_cells) {
+      PeerDelta &delta = peer_deltas_.front();
+      const auto &msg = *delta.msg;
+      size_t offset = delta.offset;
+      if (delta.tile >= msg.num_tiles) {
+        peer_deltas_.pop_front();
+        continue;
+      }
+      if (!decodeTile(msg.data.data(), msg.data.size(), offset, tile, layers,
+                      cells)) {
+        RCLCPP_WARN(nh_->get_logger(), "Invalid map delta from %s.",
+                    msg.source.c_str());
+        peer_deltas_.pop_front();
+        continue;
+      }
+      // Resume within the tile where the previous call stopped.
+      for (; delta.cell < cells.size() && n < max_cells; ++delta.cell, ++n) {
+        const Cell cell = tileCell(tile, cells[delta.cell].index);
+        const Cost cost = grid_.updateCellCost(
+            cell, peer_layer_, cells[delta.cell].costs.total());
+        if (update_log_ && (persistentLayerMask() & (1 << peer_layer_))) {
+          log_records_.push_back(updateRecord(cell, peer_layer_, cost, epoch));
+        }
+      }
+      if (delta.cell < cells.size()) {
+        break;
+      }
+      delta.offset = offset;
+      ++delta.tile;
+      delta.cell = 0;
+    }
+    if (update_log_) {
+      update_log_->append(log_records_);
+    }
+    RCLCPP_DEBUG(nh_->get_logger(),
+                 "%i cells merged from map deltas, %lu deltas queued "
+                 "(%.6f s).",
+                 n, peer_deltas_.size(), t.seconds_elapsed());
   }
 
   void receiveCloudSafe(
@@ -605,6 +2031,7 @@ public:
 
 protected:
   rclcpp::Node::SharedPtr nh_;
+  rclcpp::Time start_time_;
   rclcpp::TimerBase::SharedPtr planning_timer_;
 
   // Transforms and frames
@@ -613,22 +2040,38 @@ protected:
   float tf_timeout_{3.0};
   std::string map_frame_{"map"};
   std::string robot_frame_{"base_footprint"};
+  std::vector<std::string> robot_frames_{};
 
   // Publishers
   rclcpp::Publisher<sensor_msgs::msg::PointCloud2>::SharedPtr map_pub_;
   rclcpp::Publisher<sensor_msgs::msg::PointCloud2>::SharedPtr local_map_pub_;
   rclcpp::Publisher<std_msgs::msg::Float32>::SharedPtr planning_freq_pub_;
   rclcpp::Publisher<nav_msgs::msg::Path>::SharedPtr path_pub_;
+  rclcpp::Publisher<grid_planner::msg::MapDelta>::SharedPtr map_delta_pub_;
 
   // Subscribers
   std::vector<rclcpp::Subscription<sensor_msgs::msg::PointCloud2>::SharedPtr>
       input_cloud_subs_;
+  rclcpp::Subscription<grid_planner::msg::MapDelta>::SharedPtr
+      peer_map_delta_sub_;
 
   // Services
   rclcpp::Service<nav_msgs::srv::GetPlan>::SharedPtr get_plan_service_;
+  rclcpp::Service<grid_planner::srv::GetPlans>::SharedPtr get_plans_service_;
   nav_msgs::srv::GetPlan::Request::SharedPtr last_request_;
+  nav_msgs::msg::Path last_plan_;
   rclcpp::Service<nav2_msgs::srv::ClearEntireCostmap>::SharedPtr
       clear_map_service_;
+  rclcpp::Service<grid_planner::srv::ClearRegion>::SharedPtr
+      clear_region_service_;
+  rclcpp::Service<grid_planner::srv::ExportCostField>::SharedPtr
+      export_cost_field_service_;
+  rclcpp::Service<grid_planner::srv::QueryCostToGo>::SharedPtr
+      query_cost_to_go_service_;
+  rclcpp::Service<grid_planner::srv::QueryCosts>::SharedPtr
+      query_costs_service_;
+  rclcpp::Service<grid_planner::srv::GetAlternativePlans>::SharedPtr
+      get_alternative_plans_service_;
 
   // Input
   std::string position_field_{"x"};
@@ -642,6 +2085,93 @@ protected:
   // Grid
   Grid grid_{};
 
+  // Static map store
+  std::string static_map_store_{};
+  std::vector<long int> static_store_layers_{0};
+  float prefetch_radius_{20.0};
+  float prefetch_distance_{50.0};
+  std::unique_ptr<LazyTileLoader> tile_loader_;
+
+  // Persistence
+  // Directory with map snapshot and update log, disabled if empty.
+  std::string map_store_dir_{};
+  float snapshot_period_{60.0};
+  std::unique_ptr<UpdateLog> update_log_;
+  std::vector<UpdateRecord> log_records_;
+  // Input cloud cells and costs of a layer, reused across clouds
+  std::vector<Cell> cloud_cells_;
+  std::vector<Cost> cloud_costs_;
+  rclcpp::TimerBase::SharedPtr snapshot_timer_;
+
+  // Map deltas
+  // Layers shared with other planners, merged by them into their peer layer.
+  std::vector<long int> delta_layers_{};
+  uint8_t delta_layer_mask_{0};
+  float delta_period_{1.0};
+  int max_delta_tiles_{64};
+  // Layer to merge peer deltas into, disabled if negative.
+  int peer_layer_{-1};
+  int dynamic_layer_{-1};
+  float dynamic_ttl_{2.f};
+  TimingWheel dynamic_expiry_{};
+  int max_delta_cells_{4096};
+  // Tiles observed locally, to be sent with the next deltas
+  std::deque<Tile> delta_queue_;
+  std::unordered_set<Tile, TileHasher> delta_queued_;
+  std::unordered_map<std::string, uint32_t> peer_epochs_;
+  // Peer delta, merged up to the cell of the tile at the offset
+  struct PeerDelta {
+    std::shared_ptr<const grid_planner::msg::MapDelta> msg;
+    size_t offset{0};
+    uint32_t tile{0};
+    size_t cell{0};
+  };
+  std::deque<PeerDelta> peer_deltas_;
+  rclcpp::TimerBase::SharedPtr delta_timer_;
+  rclcpp::TimerBase::SharedPtr peer_delta_timer_;
+
+  // Robots sharing the grid
+  std::vector<Robot> robots_;
+  rclcpp::TimerBase::SharedPtr robots_timer_;
+
+  // Last search and cached cost-to-go fields
+  std::shared_ptr<ShortestPaths> last_search_;
+  // Scratch memory of a plan, and the map cloud reused across plans
+  PlanArena plan_arena_;
+  sensor_msgs::msg::PointCloud2 map_cloud_;
+  CostToGoCache cost_to_go_;
+  // Goal requests before a cost-to-go field is computed, disabled if zero.
+  int cost_to_go_min_requests_{3};
+
+  // Last path reused while cells within margin of it do not change,
+  // disabled if the margin is negative.
+  float path_check_margin_{1.0};
+  float path_cost_tolerance_{0.05};
+  PathMonitor path_monitor_;
+
+  // Plans reused while the grid does not change
+  int plan_cache_size_{16};
+  // Validate cached plans by tiles along the path instead of the grid epoch.
+  bool plan_cache_path_tiles_{false};
+  PlanCache plan_cache_;
+
+  // Alternative paths
+  // Max cost of an alternative path relative to the shortest one.
+  float alternative_max_stretch_{1.3};
+  // Max fraction of an alternative path next to other paths.
+  float alternative_max_overlap_{0.5};
+
+  // Components of traversable cells, goals outside the start component are
+  // redirected to the nearest cell within it, or rejected.
+  Components components_;
+  bool redirect_goals_{true};
+
+  // Exploration
+  Frontier frontier_;
+  std::vector<CellId> changed_cells_;
+  int min_frontier_size_{3};
+  float frontier_utility_weight_{1.0};
+
   // Graph
   int neighborhood_{8};
   Costs max_costs_;
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace naex {
+namespace grid {
+
+/**
+ * Streaming writer of float rasters in ENVI format.
+ *
+ * Raw band-interleaved lines are appended to the data file as they come,
+ * the header is written on close. Line 0 is the top (max y) of the raster.
+ */
+class RasterWriter {
+public:
+  RasterWriter(const std::string &path, uint32_t width, uint32_t height,
+               const std::vector<std::string> &band_names, double left,
+               double top, double cell_size)
+      : path_(path), width_(width), height_(height), band_names_(band_names),
+        left_(left), top_(top), cell_size_(cell_size) {
+    file_ = std::fopen(path_.c_str(), "wb");
+  }
+  ~RasterWriter() {
+    if (file_) {
+      std::fclose(file_);
+    }
+  }
+  RasterWriter(const RasterWriter &) = delete;
+  RasterWriter &operator=(const RasterWriter &) = delete;
+
+  bool good() const { return file_ != nullptr; }
+  size_t lineSize() const { return size_t(width_) * band_names_.size(); }
+
+  /** Append consecutive lines, each with width values per band. */
+  bool writeLines(const std::vector<float> &lines, uint32_t num_lines) {
+    const size_t n = num_lines * lineSize();
+    if (!file_ || lines.size() < n || lines_ + num_lines > height_) {
+      return false;
+    }
+    lines_ += num_lines;
+    return std::fwrite(lines.data(), sizeof(float), n, file_) == n;
+  }
+
+  /** Close the data file and write the header if all lines were written. */
+  bool close() {
+    if (!file_) {
+      return false;
+    }
+    const bool ok = std::fclose(file_) == 0 && lines_ == height_;
+    file_ = nullptr;
+    return ok && writeHeader();
+  }
+
+protected:
+  bool writeHeader() const {
+    FILE *f = std::fopen((path_ + ".hdr").c_str(), "w");
+    if (!f) {
+      return false;
+    }
+    const uint16_t one = 1;
+    const int byte_order =
+        *reinterpret_cast<const uint8_t *>(&one) == 1 ? 0 : 1;
+    std::fprintf(f, "ENVI\n");
+    std::fprintf(f, "description = {grid_planner cost field}\n");
+    std::fprintf(f, "samples = %u\nlines = %u\nbands = %lu\n", width_, height_,
+                 band_names_.size());
+    std::fprintf(f, "header offset = 0\nfile type = ENVI Standard\n");
+    std::fprintf(f, "data type = 4\ninterleave = bil\nbyte order = %d\n",
+                 byte_order);
+    std::fprintf(f, "map info = {Arbitrary, 1, 1, %.6f, %.6f, %.6f, %.6f}\n",
+                 left_, top_, cell_size_, cell_size_);
+    std::fprintf(f, "band names = {");
+    for (size_t i = 0; i < band_names_.size(); ++i) {
+      std::fprintf(f, "%s%s", i > 0 ? ", " : "", band_names_[i].c_str());
+    }
+    std::fprintf(f, "}\n");
+    return std::fclose(f) == 0;
+  }
+
+  std::string path_;
+  uint32_t width_;
+  uint32_t height_;
+  std::vector<std::string> band_names_;
+  double left_;
+  double top_;
+  double cell_size_;
+  FILE *file_{nullptr};
+  uint32_t lines_{0};
+};
+
+} // namespace grid
+} // namespace naex
@@ -1,69 +1,237 @@
+#pragma once
+
 #include "graph.h"
 #include "grid.h"
-#include <boost/graph/dijkstra_shortest_paths_no_color_map.hpp>
-#include <boost/graph/visitors.hpp>
-#include <stdexcept>
+#include "types.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <functional>
+#include <memory_resource>
+#include <numeric>
 #include <optional>
+#include <utility>
+#include <vector>
 
 namespace naex {
 namespace grid {
 
-struct GoalReached : public std::exception {};
+/** Search termination with multiple goals. */
+enum class GoalMode {
+  // Stop once all goals are settled.
+  ALL,
+  // Stop once any goal is settled, e.g., for a goal region.
+  ANY
+};
 
-template <typename Vertex>
-class GoalVisitor : public boost::dijkstra_visitor<boost::null_visitor> {
-public:
-  GoalVisitor(Vertex goal) : goal_(goal) {}
-  template <typename Graph>
-  void examine_vertex(Vertex u, const Graph &) {
-    if (u == goal_) throw GoalReached();
-  }
-private:
-  Vertex goal_;
+/**
+ * Search workspace, vertex arrays and the queue, reused by following
+ * searches so that these do not allocate once grown to the grid size.
+ * The queue and goal flags draw from a pool resource owned by the buffers,
+ * which keeps released blocks for reuse instead of returning them.
+ */
+struct SearchBuffers {
+  SearchBuffers() = default;
+  SearchBuffers(const SearchBuffers &) = delete;
+  SearchBuffers &operator=(const SearchBuffers &) = delete;
+
+  std::pmr::unsynchronized_pool_resource resource;
+  std::vector<VertexId> predecessors;
+  std::vector<Cost> path_costs;
+  // Binary min-heap of queued path costs and vertices, with stale entries
+  std::pmr::vector<std::pair<Cost, VertexId>> queue{&resource};
+  // Vertex to goal flag
+  std::pmr::vector<uint8_t> goals{&resource};
 };
 
+/**
+ * Dijkstra search from a start vertex, with predecessors of unreached
+ * vertices pointing to themselves.
+ *
+ * The queue is a binary heap with lazy deletion, so that it lives in a plain
+ * vector. Searches can be run again in place, reusing all arrays.
+ */
 class ShortestPaths {
 public:
+  /** No search yet, search() runs one. */
+  ShortestPaths() = default;
   ShortestPaths(const Grid &grid, VertexId start,
                 std::optional<VertexId> goal = std::nullopt,
                 uint8_t neighborhood = 8, const Costs &max_costs_ = Costs(0.0))
-      : graph_(grid, neighborhood, max_costs_), edge_costs_(graph_),
-        predecessor_(graph_.num_vertices(),
-                     std::numeric_limits<VertexId>::max()),
-        path_costs_(graph_.num_vertices(),
-                    std::numeric_limits<Cost>::infinity()) {
-    boost::typed_identity_property_map<VertexId> index_map;
-    try {
-      if (goal) {
-        boost::dijkstra_shortest_paths_no_color_map(
-            graph_, start, predecessor_.data(), path_costs_.data(), edge_costs_,
-            index_map, std::less<Cost>(), boost::closed_plus<Cost>(),
-            std::numeric_limits<Cost>::infinity(), Cost(0.),
-            GoalVisitor<VertexId>(*goal));
-      } else {
-        boost::dijkstra_shortest_paths_no_color_map(
-            graph_, start, predecessor_.data(), path_costs_.data(), edge_costs_,
-            index_map, std::less<Cost>(), boost::closed_plus<Cost>(),
-            std::numeric_limits<Cost>::infinity(), Cost(0.),
-            boost::dijkstra_visitor<boost::null_visitor>());
-      }
-    } catch (const GoalReached &) {
-      // Goal reached, early exit
-    }
+      : ShortestPaths() {
+    search(grid, start, goal, neighborhood, max_costs_);
+  }
+
+  /** Single search from start, stopped once all or any goals are settled. */
+  ShortestPaths(const Grid &grid, VertexId start,
+                const std::vector<VertexId> &goals, uint8_t neighborhood = 8,
+                const Costs &max_costs_ = Costs(0.0),
+                GoalMode mode = GoalMode::ALL)
+      : ShortestPaths() {
+    search(grid, start, goals, neighborhood, max_costs_, mode);
+  }
+  ShortestPaths(const Grid &grid, VertexId start,
+                const std::pmr::vector<VertexId> &goals,
+                uint8_t neighborhood = 8, const Costs &max_costs_ = Costs(0.0),
+                GoalMode mode = GoalMode::ALL)
+      : ShortestPaths() {
+    search(grid, start, goals, neighborhood, max_costs_, mode);
+  }
+
+  /** Search again from start, reusing the arrays of the previous search. */
+  void search(const Grid &grid, VertexId start,
+              const std::vector<VertexId> &goals, uint8_t neighborhood = 8,
+              const Costs &max_costs = Costs(0.0),
+              GoalMode mode = GoalMode::ALL) {
+    run(Graph(grid, neighborhood, max_costs), start, goals.data(),
+        goals.size(), mode);
+  }
+  void search(const Grid &grid, VertexId start,
+              const std::pmr::vector<VertexId> &goals,
+              uint8_t neighborhood = 8, const Costs &max_costs = Costs(0.0),
+              GoalMode mode = GoalMode::ALL) {
+    run(Graph(grid, neighborhood, max_costs), start, goals.data(),
+        goals.size(), mode);
+  }
+  void search(const Grid &grid, VertexId start, std::optional<VertexId> goal,
+              uint8_t neighborhood = 8, const Costs &max_costs = Costs(0.0)) {
+    run(Graph(grid, neighborhood, max_costs), start, goal ? &*goal : nullptr,
+        goal ? 1 : 0, GoalMode::ALL);
   }
 
-  const std::vector<VertexId> &predecessors() const { return predecessor_; }
-  const std::vector<Cost> &pathCosts() const { return path_costs_; }
+  const std::vector<VertexId> &predecessors() const {
+    return buffers_.predecessors;
+  }
+  const std::vector<Cost> &pathCosts() const { return buffers_.path_costs; }
 
-  const VertexId &predecessor(VertexId v) const { return predecessor_[v]; }
-  const Cost &pathCost(VertexId v) const { return path_costs_[v]; }
+  const VertexId &predecessor(VertexId v) const {
+    return buffers_.predecessors[v];
+  }
+  const Cost &pathCost(VertexId v) const { return buffers_.path_costs[v]; }
+  /** The last goal settled, INVALID_VERTEX if none. */
+  VertexId reachedGoal() const { return reached_; }
 
 protected:
-  Graph graph_;
-  EdgeCosts edge_costs_;
-  std::vector<VertexId> predecessor_;
-  std::vector<Cost> path_costs_;
+  typedef std::pair<Cost, VertexId> QueueEntry;
+
+  void run(const Graph &graph, VertexId start, const VertexId *goals,
+           size_t num_goals, GoalMode mode) {
+    const VertexId n = graph.num_vertices();
+    auto &predecessors = buffers_.predecessors;
+    auto &path_costs = buffers_.path_costs;
+    auto &queue = buffers_.queue;
+    auto &is_goal = buffers_.goals;
+    predecessors.resize(n);
+    std::iota(predecessors.begin(), predecessors.end(), VertexId(0));
+    path_costs.assign(n, Graph::INF);
+    is_goal.assign(n, 0);
+    size_t remaining = 0;
+    for (size_t i = 0; i < num_goals; ++i) {
+      if (goals[i] < n && !is_goal[goals[i]]) {
+        is_goal[goals[i]] = 1;
+        ++remaining;
+      }
+    }
+    if (mode == GoalMode::ANY) {
+      remaining = std::min(remaining, size_t(1));
+    }
+    reached_ = INVALID_VERTEX;
+    queue.clear();
+    if (start >= n) {
+      return;
+    }
+
+    const std::greater<QueueEntry> later;
+    path_costs[start] = 0;
+    queue.emplace_back(Cost(0), start);
+    while (!queue.empty()) {
+      std::pop_heap(queue.begin(), queue.end(), later);
+      const QueueEntry entry = queue.back();
+      queue.pop_back();
+      const VertexId u = entry.second;
+      // Skip entries of vertices settled with a lower cost.
+      if (entry.first > path_costs[u]) {
+        continue;
+      }
+      if (is_goal[u]) {
+        reached_ = u;
+        if (--remaining == 0) {
+          break;
+        }
+      }
+      const auto edges = graph.out_edges(u);
+      for (auto it = edges.first; it != edges.second; ++it) {
+        const VertexId v = graph.target(*it);
+        const Cost cost = entry.first + graph.cost(*it);
+        if (cost < path_costs[v]) {
+          path_costs[v] = cost;
+          predecessors[v] = u;
+          queue.emplace_back(cost, v);
+          std::push_heap(queue.begin(), queue.end(), later);
+        }
+      }
+    }
+    queue.clear();
+  }
+
+  SearchBuffers buffers_;
+  VertexId reached_{INVALID_VERTEX};
 };
 
+/** Append vertices of the path from v0 to v1, v0 first. */
+template <typename Vertices>
+void tracePathVertices(VertexId v0, VertexId v1,
+                       const std::vector<VertexId> &predecessor,
+                       Vertices &path_vertices) {
+  assert(predecessor[v0] == v0);
+  const size_t begin = path_vertices.size();
+  VertexId v = v1;
+  while (v != v0) {
+    path_vertices.push_back(v);
+    v = predecessor[v];
+  }
+  path_vertices.push_back(v);
+  std::reverse(path_vertices.begin() + begin, path_vertices.end());
+}
+
+inline std::vector<VertexId>
+tracePathVertices(VertexId v0, VertexId v1,
+                  const std::vector<VertexId> &predecessor) {
+  std::vector<VertexId> path_vertices;
+  tracePathVertices(v0, v1, predecessor, path_vertices);
+  return path_vertices;
+}
+
+/**
+ * Append the known goal cell and other known cells within tolerance from
+ * the goal, goal cell first. The grid is not modified.
+ */
+template <typename Vertices>
+void goalRegion(const Grid &grid, const Point2f &goal_point, float tolerance,
+                Vertices &region) {
+  const Cell goal = grid.pointToCell(goal_point);
+  if (const auto v = grid.findCell(goal)) {
+    region.push_back(*v);
+  }
+  if (!(tolerance > 0.f) || !std::isfinite(tolerance)) {
+    return;
+  }
+  const int r = int(std::ceil(tolerance / grid.cellSize()));
+  for (int dx = -r; dx <= r; ++dx) {
+    for (int dy = -r; dy <= r; ++dy) {
+      const Cell c(goal.x + dx, goal.y + dy);
+      if (dx == 0 && dy == 0) {
+        continue;
+      }
+      const auto v = grid.findCell(c);
+      const Point2f p = grid.cellToPoint(c);
+      if (v && std::hypot(p.x - goal_point.x, p.y - goal_point.y) <=
+                   tolerance) {
+        region.push_back(*v);
+      }
+    }
+  }
+}
+
 } // namespace grid
 } // namespace naex
\ No newline at end of file
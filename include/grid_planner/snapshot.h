@@ -0,0 +1,196 @@
+#pragma once
+
+#include "grid.h"
+#include "tiles.h"
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace naex {
+namespace grid {
+
+/**
+ * Map snapshot, a header followed by encoded tiles of all layers.
+ *
+ * Version 2 appends a tile index, num_tiles entries of uint32 tile key and
+ * uint64 tile offset, so that tiles can be read individually.
+ *
+ * Version 3 inserts coarse layers between the header and the tiles, so that
+ * coarse cells with no cell under them are kept. Each coarse layer is
+ * stored as uint8 layer, uint8 shift, uint16 reserved, uint32 number of
+ * coarse cells, and int16 x, y and float cost per coarse cell.
+ */
+struct SnapshotHeader {
+  char magic[4]{'G', 'P', 'S', 'N'};
+  uint32_t version{3};
+  float cell_size{0.f};
+  // Grid epoch at the time of the snapshot.
+  uint32_t epoch{0};
+  uint32_t num_tiles{0};
+  // Size of the coarse layers in bytes, zero before version 3.
+  uint32_t coarse_size{0};
+
+  bool valid() const {
+    return magic[0] == 'G' && magic[1] == 'P' && magic[2] == 'S' &&
+           magic[3] == 'N' && version >= 1 && version <= 3;
+  }
+  bool hasIndex() const { return version >= 2; }
+};
+static_assert(sizeof(SnapshotHeader) == 24);
+
+const size_t SNAPSHOT_INDEX_ENTRY_SIZE = sizeof(uint32_t) + sizeof(uint64_t);
+
+/** Append the masked coarse layers, skipping unknown coarse cells. */
+void encodeCoarseLayers(const Grid &grid, uint8_t layers,
+                        std::vector<uint8_t> &buf) {
+  for (int l = 0; l < 4; ++l) {
+    if (!(layers & grid.coarseLayers() & (1 << l))) {
+      continue;
+    }
+    appendBytes(uint8_t(l), buf);
+    appendBytes(grid.layerShift(l), buf);
+    appendBytes(uint16_t(0), buf);
+    const size_t count_offset = buf.size();
+    appendBytes(uint32_t(0), buf);
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < grid.coarseSize(l); ++i) {
+      const Cost cost = grid.coarseCostAt(l, i);
+      if (std::isnan(cost)) {
+        continue;
+      }
+      appendBytes(grid.coarseCellAt(l, i).x, buf);
+      appendBytes(grid.coarseCellAt(l, i).y, buf);
+      appendBytes(cost, buf);
+      ++n;
+    }
+    std::memcpy(buf.data() + count_offset, &n, sizeof(n));
+  }
+}
+
+/**
+ * Apply masked coarse layers stored with the same shift as in the grid.
+ * @return False on truncated data.
+ */
+bool decodeCoarseLayers(const uint8_t *data, size_t size, uint8_t mask,
+                        Grid &grid) {
+  size_t offset = 0;
+  while (offset < size) {
+    uint8_t layer;
+    uint8_t shift;
+    uint16_t reserved;
+    uint32_t n;
+    if (!readBytes(data, size, offset, layer) ||
+        !readBytes(data, size, offset, shift) ||
+        !readBytes(data, size, offset, reserved) ||
+        !readBytes(data, size, offset, n)) {
+      return false;
+    }
+    const size_t entry_size = 2 * sizeof(int16_t) + sizeof(Cost);
+    if (offset + size_t(n) * entry_size > size) {
+      return false;
+    }
+    if (layer >= 4 || !(mask & (1 << layer)) || !shift ||
+        grid.layerShift(layer) != shift) {
+      offset += size_t(n) * entry_size;
+      continue;
+    }
+    for (uint32_t i = 0; i < n; ++i) {
+      Cell coarse;
+      Cost cost;
+      readBytes(data, size, offset, coarse.x);
+      readBytes(data, size, offset, coarse.y);
+      readBytes(data, size, offset, cost);
+      grid.setCoarseCost(Cell(coarse.x * (1 << shift), coarse.y * (1 << shift)),
+                         layer, cost);
+    }
+  }
+  return true;
+}
+
+/** Encode the masked layers of the whole grid as a snapshot in memory. */
+void encodeSnapshot(const Grid &grid, std::vector<uint8_t> &buf,
+                    uint8_t layers = ALL_LAYERS) {
+  buf.clear();
+  buf.resize(sizeof(SnapshotHeader));
+  SnapshotHeader header;
+  header.cell_size = grid.cellSize();
+  header.epoch = grid.epoch();
+  encodeCoarseLayers(grid, layers, buf);
+  header.coarse_size = uint32_t(buf.size() - sizeof(SnapshotHeader));
+  std::vector<TileIndexEntry> index;
+  index.reserve(grid.size() / TILE_CELLS);
+  header.num_tiles = uint32_t(encodeGridTiles(grid, layers, buf, &index));
+  std::memcpy(buf.data(), &header, sizeof(header));
+  buf.reserve(buf.size() + index.size() * SNAPSHOT_INDEX_ENTRY_SIZE);
+  for (const auto &entry : index) {
+    appendBytes(entry.first, buf);
+    appendBytes(entry.second, buf);
+  }
+}
+
+/** Write buffer to a temporary file and atomically rename it to path. */
+bool writeFileAtomic(const std::string &path, const std::vector<uint8_t> &buf) {
+  const std::string tmp_path = path + ".tmp";
+  FILE *f = std::fopen(tmp_path.c_str(), "wb");
+  if (!f) {
+    return false;
+  }
+  const bool ok = std::fwrite(buf.data(), 1, buf.size(), f) == buf.size();
+  if (std::fclose(f) != 0 || !ok) {
+    std::remove(tmp_path.c_str());
+    return false;
+  }
+  return std::rename(tmp_path.c_str(), path.c_str()) == 0;
+}
+
+bool readFile(const std::string &path, std::vector<uint8_t> &buf) {
+  FILE *f = std::fopen(path.c_str(), "rb");
+  if (!f) {
+    return false;
+  }
+  std::fseek(f, 0, SEEK_END);
+  const long size = std::ftell(f);
+  std::fseek(f, 0, SEEK_SET);
+  buf.resize(size > 0 ? size : 0);
+  const bool ok = std::fread(buf.data(), 1, buf.size(), f) == buf.size();
+  std::fclose(f);
+  return ok;
+}
+
+/**
+ * Load masked layers of a snapshot into the grid, overwriting existing cells.
+ * The grid epoch is advanced to the snapshot epoch.
+ * @return Number of tiles loaded, or -1 if the snapshot is invalid.
+ */
+long loadSnapshot(const std::string &path, Grid &grid,
+                  uint8_t mask = ALL_LAYERS) {
+  std::vector<uint8_t> buf;
+  if (!readFile(path, buf)) {
+    return -1;
+  }
+  SnapshotHeader header;
+  size_t offset = 0;
+  if (!readBytes(buf.data(), buf.size(), offset, header) || !header.valid() ||
+      header.cell_size != grid.cellSize() ||
+      offset + header.coarse_size > buf.size() ||
+      !decodeCoarseLayers(buf.data() + offset, header.coarse_size, mask,
+                          grid)) {
+    return -1;
+  }
+  offset += header.coarse_size;
+  Tile tile;
+  uint8_t layers;
+  std::vector<TileCell> cells;
+  cells.reserve(TILE_CELLS);
+  for (uint32_t i = 0; i < header.num_tiles; ++i) {
+    if (!decodeTile(buf.data(), buf.size(), offset, tile, layers, cells)) {
+      return -1;
+    }
+    applyTile(tile, layers & mask, cells, grid);
+  }
+  grid.setEpoch(std::max(grid.epoch(), header.epoch));
+  return header.num_tiles;
+}
+
+} // namespace grid
+} // namespace naex
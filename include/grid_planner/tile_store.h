@@ -0,0 +1,261 @@
+#pragma once
+
+#include "grid.h"
+#include "snapshot.h"
+#include "tiles.h"
+#include "types.h"
+#include <condition_variable>
+#include <fcntl.h>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace naex {
+namespace grid {
+
+/**
+ * Read-only store of encoded tiles, backed by an indexed snapshot file.
+ *
+ * Only the header and the tile index are read on opening, tiles are read
+ * individually with positional reads, which is safe from multiple threads.
+ */
+class TileStore {
+public:
+  TileStore() {}
+  ~TileStore() {
+    if (fd_ >= 0) {
+      ::close(fd_);
+    }
+  }
+  TileStore(const TileStore &) = delete;
+  TileStore &operator=(const TileStore &) = delete;
+
+  bool open(const std::string &path, float cell_size) {
+    fd_ = ::open(path.c_str(), O_RDONLY);
+    if (fd_ < 0) {
+      return false;
+    }
+    SnapshotHeader header;
+    const off_t file_size = ::lseek(fd_, 0, SEEK_END);
+    if (::pread(fd_, &header, sizeof(header), 0) != sizeof(header) ||
+        !header.valid() || !header.hasIndex() ||
+        header.cell_size != cell_size) {
+      return false;
+    }
+    const size_t index_size =
+        size_t(header.num_tiles) * SNAPSHOT_INDEX_ENTRY_SIZE;
+    if (file_size < off_t(sizeof(header) + index_size)) {
+      return false;
+    }
+    const uint64_t index_offset = file_size - index_size;
+    std::vector<uint8_t> buf(index_size);
+    if (::pread(fd_, buf.data(), buf.size(), index_offset) !=
+        ssize_t(buf.size())) {
+      return false;
+    }
+    // Tiles are stored in index order, each ending where the next begins.
+    tiles_.reserve(header.num_tiles);
+    size_t offset = 0;
+    uint32_t key = 0;
+    uint64_t begin = 0;
+    for (uint32_t i = 0; i < header.num_tiles; ++i) {
+      uint32_t next_key;
+      uint64_t next_begin;
+      readBytes(buf.data(), buf.size(), offset, next_key);
+      readBytes(buf.data(), buf.size(), offset, next_begin);
+      if (i > 0) {
+        tiles_[keyTile(key)] = {begin, uint32_t(next_begin - begin)};
+      }
+      key = next_key;
+      begin = next_begin;
+    }
+    if (header.num_tiles > 0) {
+      tiles_[keyTile(key)] = {begin, uint32_t(index_offset - begin)};
+    }
+    return true;
+  }
+
+  size_t size() const { return tiles_.size(); }
+  bool contains(const Tile &tile) const {
+    return tiles_.find(tile) != tiles_.end();
+  }
+
+  /** Read encoded tile bytes. */
+  bool read(const Tile &tile, std::vector<uint8_t> &buf) const {
+    const auto it = tiles_.find(tile);
+    if (fd_ < 0 || it == tiles_.end()) {
+      return false;
+    }
+    buf.resize(it->second.second);
+    return ::pread(fd_, buf.data(), buf.size(), it->second.first) ==
+           ssize_t(buf.size());
+  }
+
+protected:
+  int fd_{-1};
+  // Tile to offset and size of the encoded tile.
+  std::unordered_map<Tile, std::pair<uint64_t, uint32_t>, TileHasher> tiles_;
+};
+
+/**
+ * Loads tiles from a store into the grid on first access, or ahead of time
+ * using a background prefetching thread.
+ *
+ * Only the given layers of stored tiles are applied to the grid. All methods
+ * except the prefetching itself must be called from the thread owning the
+ * grid.
+ */
+class LazyTileLoader {
+public:
+  LazyTileLoader(std::shared_ptr<const TileStore> store, uint8_t layers)
+      : store_(store), layers_(layers) {
+    prefetcher_ = std::thread(&LazyTileLoader::prefetch, this);
+  }
+  ~LazyTileLoader() {
+    {
+      Lock lock(mutex_);
+      stop_ = true;
+    }
+    cv_.notify_one();
+    prefetcher_.join();
+  }
+  LazyTileLoader(const LazyTileLoader &) = delete;
+  LazyTileLoader &operator=(const LazyTileLoader &) = delete;
+
+  const TileStore &store() const { return *store_; }
+  bool loaded(const Tile &tile) const {
+    return loaded_.find(tile) != loaded_.end();
+  }
+  const std::unordered_set<Tile, TileHasher> &loadedTiles() const {
+    return loaded_;
+  }
+
+  /**
+   * Load the tile now unless it has been loaded already.
+   * Loaded tiles advance the grid epoch, as any other update. Tiles failing
+   * to read or decode are tried again on the next access.
+   */
+  bool load(const Tile &tile, Grid &grid) {
+    if (!store_->contains(tile) || loaded(tile)) {
+      return false;
+    }
+    std::vector<uint8_t> buf;
+    if (!store_->read(tile, buf)) {
+      return false;
+    }
+    grid.advanceEpoch();
+    return apply(tile, buf, grid);
+  }
+
+  /** Queue tiles for reading in the background. */
+  void request(const std::vector<Tile> &tiles) {
+    size_t n = 0;
+    {
+      Lock lock(mutex_);
+      for (const auto &tile : tiles) {
+        if (store_->contains(tile) && !loaded(tile) &&
+            requested_.insert(tile).second) {
+          requests_.push_back(tile);
+          ++n;
+        }
+      }
+    }
+    if (n > 0) {
+      cv_.notify_one();
+    }
+  }
+
+  /** Apply tiles read in the background since the last call. */
+  size_t applyPrefetched(Grid &grid) {
+    std::vector<std::pair<Tile, std::vector<uint8_t>>> ready;
+    {
+      Lock lock(mutex_);
+      ready.swap(ready_);
+      for (const auto &tile_buf : ready) {
+        requested_.erase(tile_buf.first);
+      }
+    }
+    if (!ready.empty()) {
+      grid.advanceEpoch();
+    }
+    size_t n = 0;
+    for (const auto &tile_buf : ready) {
+      if (!loaded(tile_buf.first) &&
+          apply(tile_buf.first, tile_buf.second, grid)) {
+        ++n;
+      }
+    }
+    return n;
+  }
+
+  /** Forget loaded tiles, e.g., after clearing the grid. */
+  void reset() {
+    Lock lock(mutex_);
+    loaded_.clear();
+    requests_.clear();
+    requested_.clear();
+    ready_.clear();
+  }
+
+protected:
+  /** Apply the tile read, marking it loaded only if decoded. */
+  bool apply(const Tile &tile, const std::vector<uint8_t> &buf, Grid &grid) {
+    Tile decoded;
+    uint8_t layers;
+    std::vector<TileCell> cells;
+    size_t offset = 0;
+    if (!decodeTile(buf.data(), buf.size(), offset, decoded, layers, cells) ||
+        !(decoded == tile)) {
+      return false;
+    }
+    // Marked before applying, cells created meanwhile must not reload it.
+    loaded_.insert(tile);
+    applyTile(tile, layers & layers_, cells, grid);
+    return true;
+  }
+
+  void prefetch() {
+    std::vector<uint8_t> buf;
+    while (true) {
+      Tile tile;
+      {
+        std::unique_lock<Mutex> lock(mutex_);
+        cv_.wait(lock, [this] { return stop_ || !requests_.empty(); });
+        if (stop_) {
+          return;
+        }
+        tile = requests_.back();
+        requests_.pop_back();
+      }
+      if (!store_->read(tile, buf)) {
+        // Allow requesting the tile again.
+        Lock lock(mutex_);
+        requested_.erase(tile);
+        continue;
+      }
+      Lock lock(mutex_);
+      // Drop tiles forgotten by a reset in the meantime.
+      if (requested_.find(tile) != requested_.end()) {
+        ready_.emplace_back(tile, buf);
+      }
+    }
+  }
+
+  std::shared_ptr<const TileStore> store_;
+  uint8_t layers_;
+  std::unordered_set<Tile, TileHasher> loaded_;
+
+  Mutex mutex_;
+  std::condition_variable cv_;
+  std::vector<Tile> requests_;
+  std::unordered_set<Tile, TileHasher> requested_;
+  std::vector<std::pair<Tile, std::vector<uint8_t>>> ready_;
+  bool stop_{false};
+  std::thread prefetcher_;
+};
+
+} // namespace grid
+} // namespace naex
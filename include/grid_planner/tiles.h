@@ -0,0 +1,283 @@
+#pragma once
+
+#include "grid.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <optional>
+#include <vector>
+
+namespace naex {
+namespace grid {
+
+const uint8_t ALL_LAYERS = 0x0f;
+
+inline uint32_t tileKey(const Tile &t) {
+  return (uint32_t(uint16_t(t.x)) << 16) | uint16_t(t.y);
+}
+inline Tile keyTile(uint32_t key) {
+  return Tile(int16_t(uint16_t(key >> 16)), int16_t(uint16_t(key)));
+}
+inline int numLayers(uint8_t layers) {
+  return __builtin_popcount(layers & ALL_LAYERS);
+}
+
+struct TileCell {
+  uint8_t index;
+  Costs costs;
+};
+
+template <typename T>
+void appendBytes(const T &value, std::vector<uint8_t> &buf) {
+  const auto *p = reinterpret_cast<const uint8_t *>(&value);
+  buf.insert(buf.end(), p, p + sizeof(T));
+}
+
+template <typename T>
+bool readBytes(const uint8_t *data, size_t size, size_t &offset, T &value) {
+  if (offset + sizeof(T) > size) {
+    return false;
+  }
+  std::memcpy(&value, data + offset, sizeof(T));
+  offset += sizeof(T);
+  return true;
+}
+
+/**
+ * Append encoded tile, cells must be sorted by in-tile index.
+ *
+ * Encoded tile layout (host byte order):
+ *   int16 tx, ty
+ *   uint8 layer mask, uint8 reserved
+ *   uint16 number of cells
+ *   uint64 occupancy[4], bit i set if the cell with in-tile index i is present
+ *   float values[number of cells][number of layers in mask]
+ * NaN values are not stored, e.g., for layers not observed in the cell.
+ */
+void encodeTile(const Tile &tile, uint8_t layers,
+                const std::vector<TileCell> &cells,
+                std::vector<uint8_t> &buf) {
+  assert(cells.size() <= TILE_CELLS);
+  uint64_t occupancy[4] = {0, 0, 0, 0};
+  for (const auto &c : cells) {
+    occupancy[c.index >> 6] |= uint64_t(1) << (c.index & 63);
+  }
+  appendBytes(tile.x, buf);
+  appendBytes(tile.y, buf);
+  appendBytes(uint8_t(layers & ALL_LAYERS), buf);
+  appendBytes(uint8_t(0), buf);
+  appendBytes(uint16_t(cells.size()), buf);
+  for (int i = 0; i < 4; ++i) {
+    appendBytes(occupancy[i], buf);
+  }
+  buf.reserve(buf.size() + cells.size() * numLayers(layers) * sizeof(Cost));
+  for (const auto &c : cells) {
+    for (int l = 0; l < 4; ++l) {
+      if (layers & (1 << l)) {
+        appendBytes(c.costs[l], buf);
+      }
+    }
+  }
+}
+
+/**
+ * Decode tile at offset, advancing the offset past it.
+ * Layers not in the mask are left NaN. Returns false on truncated data.
+ */
+bool decodeTile(const uint8_t *data, size_t size, size_t &offset, Tile &tile,
+                uint8_t &layers, std::vector<TileCell> &cells) {
+  uint8_t reserved;
+  uint16_t n;
+  uint64_t occupancy[4];
+  if (!readBytes(data, size, offset, tile.x) ||
+      !readBytes(data, size, offset, tile.y) ||
+      !readBytes(data, size, offset, layers) ||
+      !readBytes(data, size, offset, reserved) ||
+      !readBytes(data, size, offset, n)) {
+    return false;
+  }
+  for (int i = 0; i < 4; ++i) {
+    if (!readBytes(data, size, offset, occupancy[i])) {
+      return false;
+    }
+  }
+  const size_t values_size = size_t(n) * numLayers(layers) * sizeof(Cost);
+  if (n > TILE_CELLS || offset + values_size > size) {
+    return false;
+  }
+  cells.clear();
+  for (int i = 0; i < TILE_CELLS; ++i) {
+    if (!(occupancy[i >> 6] & (uint64_t(1) << (i & 63)))) {
+      continue;
+    }
+    TileCell c{uint8_t(i), Costs()};
+    for (int l = 0; l < 4; ++l) {
+      if (layers & (1 << l)) {
+        readBytes(data, size, offset, c.costs[l]);
+      }
+    }
+    cells.push_back(c);
+  }
+  return cells.size() == n;
+}
+
+/**
+ * Overwrite the masked layers of decoded tile cells in the grid, marking them
+ * observed. NaN values leave the layers unchanged.
+ */
+void applyTile(const Tile &tile, uint8_t layers,
+               const std::vector<TileCell> &cells, Grid &grid) {
+  grid.touchTile(tile);
+  const uint8_t coarse = layers & grid.coarseLayers();
+  for (const auto &c : cells) {
+    const Cell cell = tileCell(tile, c.index);
+    uint8_t stored = 0;
+    for (int l = 0; l < 4; ++l) {
+      if ((layers & (1 << l)) && !std::isnan(c.costs[l])) {
+        stored |= 1 << l;
+      }
+    }
+    for (int l = 0; l < 4; ++l) {
+      if (stored & coarse & (1 << l)) {
+        grid.setCoarseCost(cell, l, c.costs[l]);
+      }
+    }
+    // Coarse layers alone do not create cells.
+    std::optional<CellId> id;
+    if (stored & ~coarse) {
+      id = grid.cellId(cell);
+    } else {
+      id = grid.findCell(cell);
+    }
+    if (!id) {
+      continue;
+    }
+    grid.markChanged(*id);
+    Costs &costs = grid.stampCosts(*id);
+    for (int l = 0; l < 4; ++l) {
+      if (!(stored & (1 << l))) {
+        continue;
+      }
+      if (!(coarse & (1 << l))) {
+        costs[l] = c.costs[l];
+      }
+      grid.markObserved(*id, l);
+    }
+    grid.updateTotal(*id);
+  }
+}
+
+/** Current costs of the cell, NaN in layers never observed. */
+inline Costs observedCosts(const Grid &grid, CellId id) {
+  Costs costs = grid.currentCosts(id);
+  for (int l = 0; l < 4; ++l) {
+    if (!grid.observations(id, l)) {
+      costs[l] = std::numeric_limits<Cost>::quiet_NaN();
+    }
+  }
+  return costs;
+}
+
+/** True if any masked layer of the costs holds a finite value. */
+inline bool anyFinite(const Costs &costs, uint8_t layers) {
+  for (int l = 0; l < 4; ++l) {
+    if ((layers & (1 << l)) && std::isfinite(costs[l])) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * Encode the masked layers of grid cells within a tile, skipping cells with
+ * no observed finite value in these layers, e.g., cells holding defaults.
+ * Layers not observed are encoded as NaN.
+ * @return True if any cell was encoded.
+ */
+bool encodeGridTile(const Grid &grid, const Tile &tile, uint8_t layers,
+                    std::vector<TileCell> &cells, std::vector<uint8_t> &buf) {
+  cells.clear();
+  for (int i = 0; i < TILE_CELLS; ++i) {
+    const auto id = grid.findCell(tileCell(tile, uint8_t(i)));
+    if (!id) {
+      continue;
+    }
+    const Costs costs = observedCosts(grid, *id);
+    if (anyFinite(costs, layers)) {
+      cells.push_back({uint8_t(i), costs});
+    }
+  }
+  if (cells.empty()) {
+    return false;
+  }
+  encodeTile(tile, layers, cells, buf);
+  return true;
+}
+
+/** Tile key and offset of the encoded tile within a buffer or file. */
+typedef std::pair<uint32_t, uint64_t> TileIndexEntry;
+
+/**
+ * Encode the masked layers of selected grid cells, tile by tile.
+ * @param costs Costs of a cell id to encode.
+ * @param index If given, tile offsets within the buffer are appended to it.
+ * @return Number of tiles encoded.
+ */
+template <typename CostsFn>
+size_t encodeCellTiles(const Grid &grid, const std::vector<CellId> &ids,
+                       uint8_t layers, CostsFn costs, std::vector<uint8_t> &buf,
+                       std::vector<TileIndexEntry> *index = nullptr) {
+  // Tile key, in-tile index, and cell id, sorted by tile and index.
+  std::vector<std::pair<uint64_t, CellId>> order;
+  order.reserve(ids.size());
+  for (const auto &v : ids) {
+    const Cell &c = grid.cell(v);
+    order.emplace_back((uint64_t(tileKey(cellToTile(c))) << 8) |
+                           cellIndexInTile(c),
+                       v);
+  }
+  std::sort(order.begin(), order.end());
+
+  size_t num_tiles = 0;
+  std::vector<TileCell> cells;
+  cells.reserve(TILE_CELLS);
+  for (size_t i = 0; i < order.size();) {
+    const uint32_t key = uint32_t(order[i].first >> 8);
+    cells.clear();
+    for (; i < order.size() && uint32_t(order[i].first >> 8) == key; ++i) {
+      cells.push_back({uint8_t(order[i].first), costs(order[i].second)});
+    }
+    if (index) {
+      index->emplace_back(key, buf.size());
+    }
+    encodeTile(keyTile(key), layers, cells, buf);
+    ++num_tiles;
+  }
+  return num_tiles;
+}
+
+/**
+ * Encode the masked layers of all grid cells, tile by tile. Cells with no
+ * observed layer in the mask are skipped, layers not observed are NaN.
+ */
+size_t encodeGridTiles(const Grid &grid, uint8_t layers,
+                       std::vector<uint8_t> &buf,
+                       std::vector<TileIndexEntry> *index = nullptr) {
+  std::vector<CellId> ids;
+  ids.reserve(grid.size());
+  for (CellId v = 0; v < grid.size(); ++v) {
+    for (int l = 0; l < 4; ++l) {
+      if ((layers & (1 << l)) && grid.observations(v, l)) {
+        ids.push_back(v);
+        break;
+      }
+    }
+  }
+  return encodeCellTiles(
+      grid, ids, layers, [&grid](CellId v) { return observedCosts(grid, v); },
+      buf, index);
+}
+
+} // namespace grid
+} // namespace naex
@@ -0,0 +1,161 @@
+#pragma once
+
+#include "grid.h"
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+
+namespace naex {
+namespace grid {
+
+/**
+ * Hierarchical timing wheel of cell expirations.
+ *
+ * Level k has 64 slots, each spanning 64^k ticks. Entries are placed at the
+ * coarsest level needed and cascade to finer levels as time approaches, so
+ * each entry is moved at most once per level and a tick costs proportionally
+ * to the entries in its slot. A cell has at most one deadline, rescheduling
+ * leaves the old entry behind to be dropped once reached.
+ */
+class TimingWheel {
+public:
+  static constexpr int BITS = 6;
+  static constexpr uint64_t SLOTS = 1 << BITS;
+  static constexpr int LEVELS = 4;
+  static constexpr uint64_t NONE = std::numeric_limits<uint64_t>::max();
+
+  TimingWheel(float resolution = 0.1f) : resolution_(resolution) {}
+
+  float resolution() const { return resolution_; }
+  size_t size() const { return size_; }
+
+  /** Schedule expiration of the cell at given time, replacing the old one. */
+  void schedule(CellId id, float time) {
+    if (id >= deadlines_.size()) {
+      deadlines_.resize(id + 1, NONE);
+    }
+    const uint64_t deadline =
+        std::max(tick_ + 1, uint64_t(std::ceil(time / resolution_)));
+    if (deadlines_[id] == NONE) {
+      ++size_;
+    }
+    deadlines_[id] = deadline;
+    insert(id, deadline);
+  }
+
+  void cancel(CellId id) {
+    if (id < deadlines_.size() && deadlines_[id] != NONE) {
+      deadlines_[id] = NONE;
+      --size_;
+    }
+  }
+
+  /** Advance to given time, calling expired(CellId) for expired cells. */
+  template <typename F> void advance(float time, F expired) {
+    const uint64_t target = uint64_t(std::max(0.f, time) / resolution_);
+    // Jump over the ticks if nothing is scheduled.
+    if (size_ == 0 && target > tick_) {
+      tick_ = target;
+    }
+    while (tick_ < target) {
+      ++tick_;
+      for (int k = 1; k < LEVELS; ++k) {
+        if (tick_ & ((uint64_t(1) << (BITS * k)) - 1)) {
+          break;
+        }
+        cascade(k);
+      }
+      auto &slot = slots_[0][tick_ & (SLOTS - 1)];
+      for (const auto &entry : slot) {
+        if (deadlines_[entry.first] != entry.second) {
+          continue;
+        }
+        deadlines_[entry.first] = NONE;
+        --size_;
+        expired(entry.first);
+      }
+      slot.clear();
+    }
+  }
+
+  /** Remap cell ids, dropping removed cells, see Grid::removeCells. */
+  void remap(const std::vector<CellId> &ids) {
+    std::vector<uint64_t> deadlines;
+    size_ = 0;
+    for (CellId id = 0; id < deadlines_.size() && id < ids.size(); ++id) {
+      if (deadlines_[id] == NONE || ids[id] == Grid::REMOVED) {
+        continue;
+      }
+      if (ids[id] >= deadlines.size()) {
+        deadlines.resize(ids[id] + 1, NONE);
+      }
+      deadlines[ids[id]] = deadlines_[id];
+      ++size_;
+    }
+    for (auto &level : slots_) {
+      for (auto &slot : level) {
+        size_t k = 0;
+        for (const auto &entry : slot) {
+          const CellId id = entry.first;
+          if (id < ids.size() && ids[id] != Grid::REMOVED &&
+              deadlines_[id] == entry.second) {
+            slot[k++] = {ids[id], entry.second};
+          }
+        }
+        slot.resize(k);
+      }
+    }
+    deadlines_.swap(deadlines);
+  }
+
+  void clear() {
+    for (auto &level : slots_) {
+      for (auto &slot : level) {
+        slot.clear();
+      }
+    }
+    deadlines_.clear();
+    size_ = 0;
+  }
+
+protected:
+  void insert(CellId id, uint64_t deadline) {
+    const uint64_t delta = deadline - tick_;
+    for (int k = 0; k < LEVELS; ++k) {
+      if (delta < (uint64_t(1) << (BITS * (k + 1)))) {
+        slots_[k][(deadline >> (BITS * k)) & (SLOTS - 1)].emplace_back(
+            id, deadline);
+        return;
+      }
+    }
+    // Beyond the range, wait in the last slot of the coarsest level.
+    const int k = LEVELS - 1;
+    slots_[k][((tick_ >> (BITS * k)) - 1) & (SLOTS - 1)].emplace_back(
+        id, deadline);
+  }
+
+  /** Move entries of the current slot of level k to finer levels. */
+  void cascade(int k) {
+    auto &slot = slots_[k][(tick_ >> (BITS * k)) & (SLOTS - 1)];
+    cascading_.swap(slot);
+    for (const auto &entry : cascading_) {
+      if (deadlines_[entry.first] == entry.second) {
+        insert(entry.first, entry.second);
+      }
+    }
+    cascading_.clear();
+  }
+
+  float resolution_;
+  uint64_t tick_{0};
+  size_t size_{0};
+  std::vector<std::pair<CellId, uint64_t>> slots_[LEVELS][SLOTS];
+  std::vector<std::pair<CellId, uint64_t>> cascading_;
+  // CellId to deadline tick, NONE if not scheduled
+  std::vector<uint64_t> deadlines_;
+};
+
+} // namespace grid
+} // namespace naex
@@ -0,0 +1,239 @@
+#pragma once
+
+#include "grid.h"
+#include "snapshot.h"
+#include "types.h"
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace naex {
+namespace grid {
+
+/**
+ * Layer value after an update, as stored in the update log. A NaN value
+ * records a reset of the layer to its default, as if never observed.
+ */
+struct UpdateRecord {
+  int16_t x;
+  int16_t y;
+  uint8_t layer;
+  uint8_t reserved[3];
+  Cost value;
+  uint32_t epoch;
+};
+static_assert(sizeof(UpdateRecord) == 16);
+
+inline UpdateRecord updateRecord(const Cell &c, uint8_t layer, Cost value,
+                                 uint32_t epoch) {
+  return UpdateRecord{c.x, c.y, layer, {0, 0, 0}, value, epoch};
+}
+
+/**
+ * Append-only log of grid updates since the last snapshot.
+ *
+ * Records are batched in memory by the caller and written sequentially by a
+ * background thread, so that appending costs only a buffer swap.
+ * Checkpoints write a new snapshot and truncate the log, records appended
+ * afterwards are kept.
+ */
+class UpdateLog {
+public:
+  typedef std::vector<std::pair<std::string, std::vector<uint8_t>>> Files;
+
+  UpdateLog(const std::string &log_path, const std::string &snapshot_path)
+      : log_path_(log_path), snapshot_path_(snapshot_path) {
+    file_ = std::fopen(log_path_.c_str(), "ab");
+    if (file_) {
+      std::setvbuf(file_, nullptr, _IOFBF, 1 << 20);
+    }
+    writer_ = std::thread(&UpdateLog::write, this);
+  }
+  ~UpdateLog() {
+    {
+      Lock lock(mutex_);
+      stop_ = true;
+    }
+    cv_.notify_one();
+    writer_.join();
+    if (file_) {
+      std::fclose(file_);
+    }
+  }
+  UpdateLog(const UpdateLog &) = delete;
+  UpdateLog &operator=(const UpdateLog &) = delete;
+
+  bool good() const { return file_ != nullptr; }
+
+  /**
+   * Number of logs which could not be truncated after a snapshot since the
+   * last call. Records are then appended to the old log, where records up to
+   * the snapshot epoch are skipped on replay.
+   */
+  size_t takeFailedTruncations() { return failed_truncations_.exchange(0); }
+
+  /**
+   * Queue records for writing. The records vector is left empty, holding a
+   * buffer already written and handed back by the writer, so that a vector
+   * reused by the caller keeps its capacity.
+   */
+  void append(std::vector<UpdateRecord> &records) {
+    if (records.empty()) {
+      return;
+    }
+    {
+      Lock lock(mutex_);
+      if (pending_.empty()) {
+        pending_.swap(records);
+        records.swap(spare_);
+      } else {
+        pending_.insert(pending_.end(), records.begin(), records.end());
+      }
+    }
+    records.clear();
+    cv_.notify_one();
+  }
+
+  /**
+   * Replace pending records with an encoded snapshot.
+   * @param files Other files to write along with the snapshot, as path and
+   * content pairs, written before the snapshot itself.
+   */
+  void checkpoint(std::vector<uint8_t> &&snapshot, Files &&files = {}) {
+    {
+      Lock lock(mutex_);
+      pending_.clear();
+      snapshot_ = std::move(snapshot);
+      files_ = std::move(files);
+      has_snapshot_ = true;
+    }
+    cv_.notify_one();
+  }
+
+protected:
+  void write() {
+    std::vector<UpdateRecord> records;
+    std::vector<uint8_t> snapshot;
+    Files files;
+    bool has_snapshot = false;
+    while (true) {
+      {
+        std::unique_lock<Mutex> lock(mutex_);
+        cv_.wait(lock, [this] {
+          return stop_ || has_snapshot_ || !pending_.empty();
+        });
+        if (has_snapshot_) {
+          snapshot.swap(snapshot_);
+          files.swap(files_);
+          has_snapshot = true;
+          has_snapshot_ = false;
+        }
+        // Hand back the written buffer for reuse by append.
+        if (spare_.capacity() < records.capacity()) {
+          spare_.swap(records);
+        }
+        records.swap(pending_);
+        if (stop_ && !has_snapshot && records.empty()) {
+          return;
+        }
+      }
+      if (has_snapshot) {
+        for (const auto &file : files) {
+          writeFileAtomic(file.first, file.second);
+        }
+        files.clear();
+        // Truncate the log only once the snapshot is in place. Keep the old
+        // handle if the log cannot be reopened.
+        if (writeFileAtomic(snapshot_path_, snapshot) && file_) {
+          if (FILE *file = std::fopen(log_path_.c_str(), "wb")) {
+            std::setvbuf(file, nullptr, _IOFBF, 1 << 20);
+            std::fclose(file_);
+            file_ = file;
+          } else {
+            ++failed_truncations_;
+          }
+        }
+        snapshot.clear();
+        has_snapshot = false;
+      }
+      if (file_ && !records.empty()) {
+        std::fwrite(records.data(), sizeof(UpdateRecord), records.size(),
+                    file_);
+        std::fflush(file_);
+      }
+      records.clear();
+    }
+  }
+
+  std::string log_path_;
+  std::string snapshot_path_;
+  FILE *file_{nullptr};
+
+  Mutex mutex_;
+  std::condition_variable cv_;
+  std::vector<UpdateRecord> pending_;
+  // Written buffer to be handed back by append
+  std::vector<UpdateRecord> spare_;
+  std::vector<uint8_t> snapshot_;
+  Files files_;
+  bool has_snapshot_{false};
+  bool stop_{false};
+  std::atomic<size_t> failed_truncations_{0};
+  std::thread writer_;
+};
+
+/**
+ * Replay logged updates of masked layers newer than the given epoch into the
+ * grid. Updated tiles are touched at the epochs of the records.
+ * A truncated trailing record, e.g. from a crash, is ignored.
+ * @return Number of records applied.
+ */
+size_t replayUpdateLog(const std::string &path, uint32_t since_epoch,
+                       Grid &grid, uint8_t layers = ALL_LAYERS) {
+  FILE *f = std::fopen(path.c_str(), "rb");
+  if (!f) {
+    return 0;
+  }
+  size_t n = 0;
+  std::vector<UpdateRecord> records(1 << 16);
+  size_t count;
+  while ((count = std::fread(records.data(), sizeof(UpdateRecord),
+                             records.size(), f)) > 0) {
+    for (size_t i = 0; i < count; ++i) {
+      const auto &r = records[i];
+      if (r.epoch <= since_epoch || r.layer >= 4 ||
+          !(layers & (1 << r.layer))) {
+        continue;
+      }
+      const Cell c(r.x, r.y);
+      grid.setEpoch(std::max(grid.epoch(), r.epoch));
+      grid.touchTile(cellToTile(c));
+      ++n;
+      if (std::isnan(r.value)) {
+        grid.resetCell(c, uint8_t(1 << r.layer));
+        continue;
+      }
+      if (grid.layerShift(r.layer)) {
+        grid.setCoarseCost(c, r.layer, r.value);
+        if (const auto id = grid.findCell(c)) {
+          grid.markObserved(*id, r.layer);
+        }
+        continue;
+      }
+      const CellId id = grid.cellId(c);
+      grid.markChanged(id);
+      grid.stampCosts(id)[r.layer] = r.value;
+      grid.updateTotal(id);
+      grid.markObserved(id, r.layer);
+    }
+  }
+  std::fclose(f);
+  return n;
+}
+
+} // namespace grid
+} // namespace naex
@@ -0,0 +1,41 @@
+#include <grid_planner/allocators.h>
+#include <cstdlib>
+#include <new>
+
+// Global allocation functions counting heap allocations, see
+// naex::grid::allocationCount().
+void *operator new(std::size_t size) {
+  naex::grid::allocationCounter().fetch_add(1, std::memory_order_relaxed);
+  if (void *p = std::malloc(size ? size : 1)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+void *operator new[](std::size_t size) { return ::operator new(size); }
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete[](void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::size_t) noexcept { std::free(p); }
+
+// Over-aligned allocations, e.g., from std::pmr::new_delete_resource().
+void *operator new(std::size_t size, std::align_val_t align) {
+  naex::grid::allocationCounter().fetch_add(1, std::memory_order_relaxed);
+  const std::size_t a = static_cast<std::size_t>(align);
+  // Size must be a non-zero multiple of the alignment.
+  const std::size_t n = size ? (size + a - 1) / a * a : a;
+  if (void *p = std::aligned_alloc(a, n)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+void *operator new[](std::size_t size, std::align_val_t align) {
+  return ::operator new(size, align);
+}
+void operator delete(void *p, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t, std::align_val_t) noexcept {
+  std::free(p);
+}
+void operator delete[](void *p, std::size_t, std::align_val_t) noexcept {
+  std::free(p);
+}
@@ -0,0 +1,70 @@
+#include <grid_planner/allocators.h>
+#include <grid_planner/search.h>
+#include <cstdio>
+
+using namespace naex;
+using namespace naex::grid;
+
+/**
+ * Planning core as run by the planner for a goal: the goal region and the
+ * path live in the plan arena, the search is reused in place.
+ */
+size_t plan(const Grid &grid, ShortestPaths &sp, PlanArena &arena,
+            VertexId start, const Point2f &goal, float tolerance,
+            uint8_t neighborhood, const Costs &max_costs) {
+  std::pmr::vector<VertexId> goal_region(arena.resource());
+  goalRegion(grid, goal, tolerance, goal_region);
+  sp.search(grid, start, goal_region, neighborhood, max_costs, GoalMode::ANY);
+  std::pmr::vector<VertexId> path(arena.resource());
+  if (sp.reachedGoal() != INVALID_VERTEX) {
+    tracePathVertices(start, sp.reachedGoal(), sp.predecessors(), path);
+  }
+  return path.size();
+}
+
+// Repeated plans with a reused ShortestPaths and a plan arena released after
+// each plan, as done by the planner, must not allocate once grown.
+int main() {
+  Grid grid(0.5f, 0.3f, Costs(1.f, 0.f));
+  for (int x = 0; x < 200; ++x) {
+    for (int y = 0; y < 200; ++y) {
+      // Leave out a wall with a gap.
+      if (x == 100 && y > 10) {
+        continue;
+      }
+      grid.updateCellCost(Cell(x, y), 0, Cost(1 + (x * y) % 7));
+    }
+  }
+  const Costs max_costs(10.f, 1.f);
+  const VertexId n = grid.size();
+  const Point2f goals[3] = {{90.f, 90.f}, {10.f, 95.f}, {55.f, 2.f}};
+
+  // Start with a small arena, grown by the warm-up plans.
+  PlanArena arena(64);
+  ShortestPaths sp;
+  if (!plan(grid, sp, arena, 0, goals[0], 2.f, 8, max_costs)) {
+    std::fprintf(stderr, "No path to the goal.\n");
+    return 1;
+  }
+  arena.release();
+  const auto plans = [&]() {
+    for (VertexId i = 0; i < 20; ++i) {
+      const VertexId start = (i * 7919) % n;
+      plan(grid, sp, arena, start, goals[i % 3], 2.f, 8, max_costs);
+      arena.release();
+      plan(grid, sp, arena, start, goals[(i + 1) % 3], 0.f, 4, max_costs);
+      arena.release();
+      sp.search(grid, start, std::nullopt, 8, max_costs);
+    }
+  };
+  plans();
+
+  const size_t allocations = allocationCount();
+  plans();
+  const size_t count = allocationCount() - allocations;
+  if (count > 0) {
+    std::fprintf(stderr, "%lu allocations in repeated plans.\n", count);
+    return 1;
+  }
+  return 0;
+}